@@ -0,0 +1,414 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+#define STB_IMAGE_IMPLEMENTATION	// normally compiled into Walnut
+#include <stb_image.h>
+
+#include <glm/glm.hpp>
+
+#include "Renderer.h"
+#include "Camera.h"
+#include "Scene.h"
+#include "Objects.h"
+#include "ThreadPool.h"
+#include "Rng.h"
+
+
+/* Renders a fixed set of scenes with fixed seeds and reports ray throughput and frame times for several thread
+* counts as JSON, so that results from different builds of the tracer can be compared directly. */
+
+using RenderProperties = decltype(Renderer::properties);
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+	uint32_t
+		width{ 640 },
+		height{ 360 },
+		frames{ 5 },
+		seed{ 1 };
+	int32_t
+		spp{ 2 },
+		bounces{ 5 };
+	std::vector<uint32_t> threads;
+	std::string
+		only,	// run a single scene
+		output{ "benchmark.json" };
+};
+
+struct BenchScene {
+	std::string name;
+	std::unique_ptr<Scene> scene;
+	glm::vec3 position, direction;
+};
+
+struct ThroughputResult {
+	double
+		primary_rps{ 0. },
+		secondary_rps{ 0. };
+};
+struct FrameResult {
+	double mean_ms{ 0. }, min_ms{ 0. }, max_ms{ 0. };
+};
+struct Run {
+	uint32_t threads{ 0 };
+	ThroughputResult throughput;
+	FrameResult frame;
+};
+struct SceneResult {
+	std::string name;
+	uint32_t primitives[Primitive_Count];
+	uint64_t primary_rays{ 0 }, secondary_rays{ 0 };
+	double primary_tests{ 0. }, secondary_tests{ 0. };		// per ray
+	std::vector<Run> runs;
+};
+
+
+static double seconds(clock_type::time_point a, clock_type::time_point b) {
+	return std::chrono::duration<double>(b - a).count();
+}
+
+
+// ---- Scenes -----------------------------------------------------------------------------------------------------
+
+static std::vector<std::unique_ptr<Material>> bench_materials;	// owned for the lifetime of the scenes that use them
+
+static void frameBounds(BenchScene& b, glm::vec3 from) {	// looks at the whole scene along 'from'
+	const AABB box = b.scene->bounds();
+	const glm::vec3 c = box.center();
+	const float r = glm::length(box.extent()) * 0.5f;
+	from = glm::normalize(from);
+	b.position = c + from * (r * 1.1f);
+	b.direction = -from;
+}
+
+static std::unique_ptr<Scene> sphereStress(uint32_t count, uint32_t seed) {
+	if (bench_materials.empty()) {
+		bench_materials.push_back(std::make_unique<PhysicalBase>(1.f));
+		bench_materials.push_back(std::make_unique<PhysicalBase>(0.5f, 0.1f));
+		bench_materials.push_back(std::make_unique<PhysicalBase>(0.f, 0.05f));
+		bench_materials.push_back(std::make_unique<PhysicalBase>(0.f, 0.f, 1.f, 1.5f));
+		bench_materials.push_back(std::make_unique<PhysicalBase>(0.2f, 0.f, 0.9f, 1.33f));
+		bench_materials.push_back(std::make_unique<PhysicalBase>(0.8f, 0.3f));
+	}
+	std::vector<std::shared_ptr<Interactable>> objs;
+	objs.reserve(count + 1);
+	objs.push_back(std::make_shared<Sphere>(glm::vec3{ 0.f, -10000.f, 0.f }, 10000.f));
+	Rng rng{ seed, 0 };
+	for (uint32_t i = 0; i < count; i++) {
+		const float r = rng.Float(0.1f, 0.6f);
+		objs.push_back(std::make_shared<Sphere>(
+			glm::vec3{ rng.Float(-40.f, 40.f), r + rng.Float(0.f, 6.f), rng.Float(-40.f, 40.f) },
+			r,
+			bench_materials[rng.next() % bench_materials.size()].get(),
+			StaticColor::DEFAULT.get(),
+			rng.Float() < 0.02f ? 2.f : 0.f
+		));
+	}
+	return std::make_unique<Scene>(std::move(objs));
+}
+
+static std::unique_ptr<Scene> terrainMesh(uint32_t res, uint32_t seed) {	// res x res quads of heightfield
+	Rng rng{ seed, 1 };
+	std::vector<glm::vec3> verts;
+	std::vector<uint32_t> idx;
+	verts.reserve((res + 1) * (res + 1));
+	idx.reserve(res * res * 6);
+	const float
+		size = 50.f,
+		step = size / res,
+		phase = rng.Float(0.f, 6.28f);
+	for (uint32_t z = 0; z <= res; z++) {
+		for (uint32_t x = 0; x <= res; x++) {
+			const float
+				px = x * step - size * 0.5f,
+				pz = z * step - size * 0.5f;
+			const float h =
+				2.f * std::sin(px * 0.21f + phase) * std::cos(pz * 0.17f) +
+				0.6f * std::sin(px * 0.9f - pz * 0.7f) +
+				rng.Float(-0.05f, 0.05f);
+			verts.push_back(glm::vec3{ px, h, pz });
+		}
+	}
+	for (uint32_t z = 0; z < res; z++) {
+		for (uint32_t x = 0; x < res; x++) {
+			const uint32_t i = z * (res + 1) + x;
+			idx.insert(idx.end(), { i, i + res + 1, i + 1, i + 1, i + res + 1, i + res + 2 });
+		}
+	}
+	auto mesh = std::make_shared<const Mesh>(verts, idx);
+	return std::make_unique<Scene>(std::vector<std::shared_ptr<Interactable>>{
+		std::make_shared<Instance>(mesh),
+		std::make_shared<Sphere>(glm::vec3{ 0.f, 12.f, 0.f }, 3.f, PhysicalBase::DEFAULT.get(), StaticColor::DEFAULT.get(), 2.f)
+	});
+}
+
+static std::vector<BenchScene> buildScenes(const Options& o) {
+	std::vector<BenchScene> scenes;
+	auto add = [&](const char* name, std::unique_ptr<Scene> s) -> BenchScene& {
+		scenes.push_back(BenchScene{ name, std::move(s), glm::vec3{ 0.f, 0.f, 3.f }, glm::vec3{ 0.f, 0.f, -1.f } });
+		return scenes.back();
+	};
+	auto wanted = [&](const char* name) { return o.only.empty() || o.only == name; };
+
+	if (wanted("demo")) {
+		add("demo", std::make_unique<Scene>(demo));		// same view as the app starts with
+	}
+	if (wanted("frc_field")) {
+		frameBounds(add("frc_field", std::make_unique<Scene>(frc_field)), glm::vec3{ 0.3f, -0.6f, 0.75f });
+	}
+	if (wanted("sphere_stress")) {
+		BenchScene& b = add("sphere_stress", sphereStress(20000, o.seed));
+		b.position = glm::vec3{ 0.f, 14.f, 52.f };	// the ground sphere would dominate the bounds
+		b.direction = glm::normalize(glm::vec3{ 0.f, -0.3f, -1.f });
+	}
+	if (wanted("terrain_mesh")) {
+		frameBounds(add("terrain_mesh", terrainMesh(384, o.seed)), glm::vec3{ 0.2f, 0.5f, 1.f });
+	}
+	return scenes;
+}
+
+
+// ---- Measurements -----------------------------------------------------------------------------------------------
+
+struct RaySet {
+	std::vector<Ray> rays;
+	double tests_per_ray{ 0. };
+};
+
+// primary rays through every pixel and one redirected bounce from each primary hit, generated once per scene
+static void buildRays(const Scene& scene, const Camera::RayGenerator& gen, uint32_t seed, RaySet& primary, RaySet& secondary) {
+	const uint32_t w = gen.GetWidth(), h = gen.GetHeight();
+	primary.rays.resize((size_t)w * h);
+	secondary.rays.clear();
+	TraceStats ps, ss;
+	for (uint32_t y = 0; y < h; y++) {
+		for (uint32_t x = 0; x < w; x++) {
+			const uint32_t i = y * w + x;
+			Ray& r = primary.rays[i] = Ray{ gen.GetPosition(), gen.GetRayDirection(x, y) };
+			Hit hit;
+			if (scene.intersect(r, hit, 1e-5f, std::numeric_limits<float>::infinity(), &ps)) {
+				Rng rng{ seed, i };
+				Ray bounce;
+				if (scene.surfaceRedirect(r, hit, bounce, rng)) {
+					secondary.rays.push_back(bounce);
+				}
+			}
+		}
+	}
+	for (const Ray& r : secondary.rays) {
+		Hit hit;
+		scene.intersect(r, hit, 1e-5f, std::numeric_limits<float>::infinity(), &ss);
+	}
+	primary.tests_per_ray = ps.rays ? (double)ps.primitive_tests / ps.rays : 0.;
+	secondary.tests_per_ray = ss.rays ? (double)ss.primitive_tests / ss.rays : 0.;
+}
+
+static double traceRate(const Scene& scene, const std::vector<Ray>& rays, ThreadPool& pool) {	// rays per second
+	constexpr uint32_t CHUNK = 1024;
+	if (rays.empty()) { return 0.; }
+	const uint32_t chunks = (uint32_t)((rays.size() + CHUNK - 1) / CHUNK);
+	std::vector<uint32_t> hits(chunks);		// keeps the traces from being optimized out
+	const clock_type::time_point start = clock_type::now();
+	pool.run(chunks, [&](uint32_t c) {
+		const size_t end = std::min(rays.size(), (size_t)(c + 1) * CHUNK);
+		uint32_t n = 0;
+		for (size_t i = (size_t)c * CHUNK; i < end; i++) {
+			Hit hit;
+			n += scene.intersect(rays[i], hit);
+		}
+		hits[c] = n;
+	});
+	return rays.size() / std::max(seconds(start, clock_type::now()), 1e-9);
+}
+
+static FrameResult frameTimes(const Scene& scene, const Camera& cam, const Options& o, uint32_t threads) {
+	RenderProperties p{};
+	p.render_flags = Renderer::RenderMode_Accumulate | (threads > 1 ? Renderer::RenderMode_Parallelize : 0);
+	p.cpu_threads = (int32_t)threads;
+	p.pixel_samples = o.spp;
+	p.bounce_limit = o.bounces;
+	p.seed = (int32_t)o.seed;
+	Renderer renderer{ p };
+	renderer.resize(o.width, o.height);
+	renderer.render(scene, cam);	// warm up (spawns the pool, touches the buffers)
+
+	FrameResult r;
+	r.min_ms = std::numeric_limits<double>::infinity();
+	for (uint32_t f = 0; f < o.frames; f++) {
+		const clock_type::time_point start = clock_type::now();
+		renderer.render(scene, cam);
+		const double ms = seconds(start, clock_type::now()) * 1e3;
+		r.mean_ms += ms;
+		r.min_ms = std::min(r.min_ms, ms);
+		r.max_ms = std::max(r.max_ms, ms);
+	}
+	r.mean_ms /= o.frames;
+	return r;
+}
+
+
+// ---- Output -----------------------------------------------------------------------------------------------------
+
+static bool writeJson(const std::string& path, const Options& o, const std::vector<SceneResult>& results) {
+	FILE* f = std::fopen(path.c_str(), "w");
+	if (!f) { return false; }
+	std::fprintf(f, "{\n");
+	std::fprintf(f, "  \"benchmark\": \"render_kernels\",\n");
+	std::fprintf(f, "  \"version\": 1,\n");
+	std::fprintf(f, "  \"config\": {\n");
+	std::fprintf(f, "    \"width\": %u,\n    \"height\": %u,\n", o.width, o.height);
+	std::fprintf(f, "    \"samples_per_pixel\": %d,\n    \"bounces\": %d,\n", o.spp, o.bounces);
+	std::fprintf(f, "    \"frames\": %u,\n    \"seed\": %u,\n", o.frames, o.seed);
+	std::fprintf(f, "    \"kernels\": \"%s\",\n", IntersectKernels::active().name);
+	std::fprintf(f, "    \"hardware_threads\": %u\n", ThreadPool::hardwareThreads());
+	std::fprintf(f, "  },\n");
+	std::fprintf(f, "  \"scenes\": [\n");
+	for (size_t s = 0; s < results.size(); s++) {
+		const SceneResult& r = results[s];
+		std::fprintf(f, "    {\n");
+		std::fprintf(f, "      \"name\": \"%s\",\n", r.name.c_str());
+		std::fprintf(f, "      \"primitives\": { \"spheres\": %u, \"triangles\": %u, \"instances\": %u },\n",
+			r.primitives[Primitive_Sphere], r.primitives[Primitive_Triangle], r.primitives[Primitive_Instance]);
+		std::fprintf(f, "      \"primary_rays\": %llu,\n", (unsigned long long)r.primary_rays);
+		std::fprintf(f, "      \"secondary_rays\": %llu,\n", (unsigned long long)r.secondary_rays);
+		std::fprintf(f, "      \"primary_tests_per_ray\": %.3f,\n", r.primary_tests);
+		std::fprintf(f, "      \"secondary_tests_per_ray\": %.3f,\n", r.secondary_tests);
+		std::fprintf(f, "      \"runs\": [\n");
+		for (size_t i = 0; i < r.runs.size(); i++) {
+			const Run& run = r.runs[i];
+			const double total_s =
+				(run.throughput.primary_rps > 0. ? r.primary_rays / run.throughput.primary_rps : 0.) +
+				(run.throughput.secondary_rps > 0. ? r.secondary_rays / run.throughput.secondary_rps : 0.);
+			std::fprintf(f, "        { \"threads\": %u, \"rays_per_second\": %.0f, \"primary_rays_per_second\": %.0f, "
+				"\"secondary_rays_per_second\": %.0f, \"frame_ms\": { \"mean\": %.3f, \"min\": %.3f, \"max\": %.3f } }%s\n",
+				run.threads,
+				total_s > 0. ? (r.primary_rays + r.secondary_rays) / total_s : 0.,
+				run.throughput.primary_rps, run.throughput.secondary_rps,
+				run.frame.mean_ms, run.frame.min_ms, run.frame.max_ms,
+				i + 1 < r.runs.size() ? "," : "");
+		}
+		std::fprintf(f, "      ]\n");
+		std::fprintf(f, "    }%s\n", s + 1 < results.size() ? "," : "");
+	}
+	std::fprintf(f, "  ]\n}\n");
+	return std::fclose(f) == 0;
+}
+
+
+static void printUsage(const char* exe) {
+	std::printf(
+		"Usage: %s [options]\n"
+		"  --size <w>x<h>          render resolution (640x360)\n"
+		"  --frames <n>            timed frames per run (5)\n"
+		"  --spp <n>               samples per pixel (2)\n"
+		"  --bounces <n>           max bounces (5)\n"
+		"  --threads <a,b,...>     thread counts to run (powers of two up to the hardware threads)\n"
+		"  --seed <n>              seed for scene generation and sampling (1)\n"
+		"  --scene <name>          only run demo, frc_field, sphere_stress or terrain_mesh\n"
+		"  -o, --output <file>     JSON report (benchmark.json)\n",
+		exe
+	);
+}
+
+static bool parseArgs(int argc, char** argv, Options& o) {
+	for (int i = 1; i < argc; i++) {
+		const char* a = argv[i];
+		const char* v = (i + 1 < argc) ? argv[++i] : nullptr;
+		if (!std::strcmp(a, "-h") || !std::strcmp(a, "--help") || !v) {
+			return false;
+		} else if (!std::strcmp(a, "--size")) {
+			if (std::sscanf(v, "%ux%u", &o.width, &o.height) != 2) return false;
+		} else if (!std::strcmp(a, "--frames")) {
+			o.frames = (uint32_t)std::max(std::atoi(v), 1);
+		} else if (!std::strcmp(a, "--spp")) {
+			o.spp = std::max(std::atoi(v), 1);
+		} else if (!std::strcmp(a, "--bounces")) {
+			o.bounces = std::max(std::atoi(v), 1);
+		} else if (!std::strcmp(a, "--threads")) {
+			for (const char* c = v; *c; ) {
+				const int t = std::atoi(c);
+				if (t > 0) { o.threads.push_back((uint32_t)t); }
+				while (*c && *c != ',') { c++; }
+				if (*c == ',') { c++; }
+			}
+		} else if (!std::strcmp(a, "--seed")) {
+			o.seed = (uint32_t)std::strtoul(v, nullptr, 10);
+		} else if (!std::strcmp(a, "--scene")) {
+			o.only = v;
+		} else if (!std::strcmp(a, "-o") || !std::strcmp(a, "--output")) {
+			o.output = v;
+		} else {
+			std::fprintf(stderr, "Unknown option: %s\n", a);
+			return false;
+		}
+	}
+	if (o.threads.empty()) {
+		const uint32_t hw = ThreadPool::hardwareThreads();
+		for (uint32_t t = 1; t < hw; t *= 2) { o.threads.push_back(t); }
+		o.threads.push_back(hw);
+	}
+	return o.width > 0 && o.height > 0;
+}
+
+
+int main(int argc, char** argv) {
+	Options o;
+	if (!parseArgs(argc, argv, o)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+	std::vector<BenchScene> scenes = buildScenes(o);
+	if (scenes.empty()) {
+		std::fprintf(stderr, "Unknown scene: %s\n", o.only.c_str());
+		return 1;
+	}
+	std::printf("Kernels: %s, %ux%u, %d spp, %d bounces, %u frames\n",
+		IntersectKernels::active().name, o.width, o.height, o.spp, o.bounces, o.frames);
+
+	std::vector<SceneResult> results;
+	for (BenchScene& b : scenes) {
+		Camera cam{ 60.f, 0.1f, 1000.f };
+		cam.SetView(b.position, b.direction);
+		cam.OnResize(o.width, o.height);
+
+		SceneResult r;
+		r.name = b.name;
+		for (uint32_t t = 0; t < Primitive_Count; t++) {
+			r.primitives[t] = (uint32_t)b.scene->getPrimitives().getBVH((PrimitiveType)t).get().getIndices().size();
+		}
+		RaySet primary, secondary;
+		buildRays(*b.scene, cam.GetRayGenerator(), o.seed, primary, secondary);
+		r.primary_rays = primary.rays.size();
+		r.secondary_rays = secondary.rays.size();
+		r.primary_tests = primary.tests_per_ray;
+		r.secondary_tests = secondary.tests_per_ray;
+
+		for (uint32_t threads : o.threads) {
+			ThreadPool pool{ threads };
+			Run run;
+			run.threads = threads;
+			run.throughput.primary_rps = traceRate(*b.scene, primary.rays, pool);
+			run.throughput.secondary_rps = traceRate(*b.scene, secondary.rays, pool);
+			run.frame = frameTimes(*b.scene, cam, o, threads);
+			r.runs.push_back(run);
+			std::printf("%-14s %3u thread(s): %8.2f Mrays/s primary, %8.2f Mrays/s secondary, %9.2f ms/frame\n",
+				b.name.c_str(), threads, run.throughput.primary_rps * 1e-6, run.throughput.secondary_rps * 1e-6, run.frame.mean_ms);
+		}
+		std::printf("%-14s tests/ray: %.2f primary, %.2f secondary\n", b.name.c_str(), r.primary_tests, r.secondary_tests);
+		results.push_back(std::move(r));
+	}
+
+	if (!writeJson(o.output, o, results)) {
+		std::fprintf(stderr, "Failed to write %s\n", o.output.c_str());
+		return 1;
+	}
+	std::printf("Wrote %s\n", o.output.c_str());
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+project "Headless Renderer"
+   kind "ConsoleApp"
+   language "C++"
+   cppdialect "C++17"
+   staticruntime "off"
+
+   -- the render core is shared with the Walnut app, minus everything that needs a window or ImGui
+   files
+   {
+      "src/**.h",
+      "src/**.cpp",
+      "../Test Application/src/**.h",
+      "../Test Application/src/**.cpp",
+   }
+   removefiles
+   {
+      "../Test Application/src/WalnutApp.cpp",
+      "../Test Application/src/Util.*",
+   }
+
+   includedirs
+   {
+      "../Test Application/src",
+      "../Walnut/vendor/glm",
+      "../Walnut/vendor/stb_image",
+   }
+
+   defines { "RT_HEADLESS" }
+
+   targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
+   objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
+
+   filter "system:windows"
+      systemversion "latest"
+
+   filter "system:linux"
+      links { "pthread" }
+
+   filter "configurations:Debug"
+      runtime "Debug"
+      symbols "On"
+
+   filter "configurations:Release"
+      runtime "Release"
+      optimize "On"
+      symbols "On"
+
+   filter "configurations:Dist"
+      runtime "Release"
+      optimize "On"
+      symbols "Off"
\ No newline at end of file
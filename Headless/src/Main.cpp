@@ -0,0 +1,235 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#define STB_IMAGE_IMPLEMENTATION	// normally compiled into Walnut
+#include <stb_image.h>
+
+#include <glm/glm.hpp>
+
+#include "Renderer.h"
+#include "Camera.h"
+#include "Scene.h"
+#include "Objects.h"
+
+
+using RenderProperties = decltype(Renderer::properties);
+
+struct Options {
+	std::string
+		scene{ "demo" },
+		output{ "render.ppm" },
+		stats,		// per-frame profile, written as csv when set
+		checkpoint;		// resumed from if it exists, and saved to
+	glm::vec3
+		position{ 0.f, 0.f, 3.f },
+		direction{ 0.f, 0.f, -1.f };
+	float fov{ 60.f };
+	uint32_t
+		width{ 1280 },
+		height{ 720 },
+		frames{ 1 },		// accumulated passes
+		checkpoint_every{ 0 };	// frames between checkpoints, besides the one at the end
+	RenderProperties properties{};
+};
+
+static void printUsage(const char* exe) {
+	std::printf(
+		"Usage: %s [options]\n"
+		"  --scene <name>          scene to render (demo)\n"
+		"  --camera x,y,z[,dx,dy,dz]  camera position and view direction\n"
+		"  --fov <degrees>         vertical field of view\n"
+		"  --size <w>x<h>          output resolution\n"
+		"  --spp <n>               samples per pixel per frame\n"
+		"  --frames <n>            frames to accumulate\n"
+		"  --bounces <n>           max bounces per path\n"
+		"  --roulette <n>          bounces before russian roulette may end a path\n"
+		"  --threads <n>           render threads (1 renders serially)\n"
+		"  --seed <n>              sampling seed\n"
+		"  --sampler <s>           random, sobol (default) or bluenoise\n"
+		"  --mode <m>              tiles, packets or wavefront\n"
+		"  --aa                    jitter primary rays\n"
+		"  --pin                   pin render threads to cores\n"
+		"  --adaptive <error>      stop tracing pixels once their standard error is below this (e.g. 0.001)\n"
+		"  --budget <ms>           time per frame to keep accumulating passes for\n"
+		"  --checkpoint <file>     resume the accumulation from this file if it matches, and save it there when done\n"
+		"  --checkpoint-every <n>  also save the checkpoint every n frames\n"
+		"  --stats <file>          write per-frame profiling counters as CSV\n"
+		"  -o, --output <file>     output image (binary PPM)\n",
+		exe
+	);
+}
+
+static const Scene* findScene(const std::string& name) {
+	if (name == "demo") { return &demo; }
+	return nullptr;
+}
+
+static bool parseArgs(int argc, char** argv, Options& o) {
+	RenderProperties& p = o.properties;
+	p.render_flags |= Renderer::RenderMode_Parallelize;
+	for (int i = 1; i < argc; i++) {
+		const char* a = argv[i];
+		const char* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		auto value = [&]() { if (!v) { std::fprintf(stderr, "Missing value for %s\n", a); } i++; return v; };
+
+		if (!std::strcmp(a, "-h") || !std::strcmp(a, "--help")) {
+			return false;
+		} else if (!std::strcmp(a, "--scene")) {
+			if (!value()) return false;
+			o.scene = v;
+		} else if (!std::strcmp(a, "--camera")) {
+			if (!value()) return false;
+			glm::vec3 d = o.direction;
+			if (std::sscanf(v, "%f,%f,%f,%f,%f,%f", &o.position.x, &o.position.y, &o.position.z, &d.x, &d.y, &d.z) < 3) return false;
+			o.direction = d;
+		} else if (!std::strcmp(a, "--fov")) {
+			if (!value()) return false;
+			o.fov = (float)std::atof(v);
+		} else if (!std::strcmp(a, "--size")) {
+			if (!value() || std::sscanf(v, "%ux%u", &o.width, &o.height) != 2) return false;
+		} else if (!std::strcmp(a, "--spp")) {
+			if (!value()) return false;
+			p.pixel_samples = std::max(std::atoi(v), 1);
+		} else if (!std::strcmp(a, "--frames")) {
+			if (!value()) return false;
+			o.frames = (uint32_t)std::max(std::atoi(v), 1);
+		} else if (!std::strcmp(a, "--bounces")) {
+			if (!value()) return false;
+			p.bounce_limit = std::max(std::atoi(v), 1);
+		} else if (!std::strcmp(a, "--roulette")) {
+			if (!value()) return false;
+			p.roulette_depth = std::max(std::atoi(v), 0);
+		} else if (!std::strcmp(a, "--threads")) {
+			if (!value()) return false;
+			p.cpu_threads = std::max(std::atoi(v), 1);
+			if (p.cpu_threads == 1) { p.render_flags &= ~Renderer::RenderMode_Parallelize; }
+		} else if (!std::strcmp(a, "--seed")) {
+			if (!value()) return false;
+			p.seed = std::atoi(v);
+		} else if (!std::strcmp(a, "--sampler")) {
+			if (!value()) return false;
+			if (!std::strcmp(v, "random")) { p.sampler = Rng::Sequence_Random; }
+			else if (!std::strcmp(v, "sobol")) { p.sampler = Rng::Sequence_Sobol; }
+			else if (!std::strcmp(v, "bluenoise")) { p.sampler = Rng::Sequence_BlueNoise; }
+			else return false;
+		} else if (!std::strcmp(a, "--mode")) {
+			if (!value()) return false;
+			if (!std::strcmp(v, "packets")) { p.render_flags |= Renderer::RenderMode_Packets; }
+			else if (!std::strcmp(v, "wavefront")) { p.render_flags |= Renderer::RenderMode_Wavefront; }
+			else if (std::strcmp(v, "tiles")) return false;
+		} else if (!std::strcmp(a, "--aa")) {
+			p.render_flags |= Renderer::RenderMode_AA_Random;
+		} else if (!std::strcmp(a, "--adaptive")) {
+			if (!value()) return false;
+			p.render_flags |= Renderer::RenderMode_Adaptive;
+			p.adaptive_threshold = (float)std::atof(v);
+		} else if (!std::strcmp(a, "--budget")) {
+			if (!value()) return false;
+			p.render_flags |= Renderer::RenderMode_Time_Budget;
+			p.target_frame_ms = (float)std::atof(v);
+		} else if (!std::strcmp(a, "--pin")) {
+			p.render_flags |= Renderer::RenderMode_Pin_Threads;
+		} else if (!std::strcmp(a, "--checkpoint")) {
+			if (!value()) return false;
+			o.checkpoint = v;
+		} else if (!std::strcmp(a, "--checkpoint-every")) {
+			if (!value()) return false;
+			o.checkpoint_every = (uint32_t)std::max(std::atoi(v), 0);
+		} else if (!std::strcmp(a, "--stats")) {
+			if (!value()) return false;
+			o.stats = v;
+		} else if (!std::strcmp(a, "-o") || !std::strcmp(a, "--output")) {
+			if (!value()) return false;
+			o.output = v;
+		} else {
+			std::fprintf(stderr, "Unknown option: %s\n", a);
+			return false;
+		}
+	}
+	return o.width > 0 && o.height > 0;
+}
+
+static bool writePPM(const std::string& path, const uint32_t* rgba, uint32_t w, uint32_t h) {
+	FILE* f = std::fopen(path.c_str(), "wb");
+	if (!f) { return false; }
+	std::fprintf(f, "P6\n%u %u\n255\n", w, h);
+	std::vector<uint8_t> row(w * 3);
+	for (uint32_t y = h; y-- > 0;) {	// output rows are stored bottom up
+		for (uint32_t x = 0; x < w; x++) {
+			const uint32_t c = rgba[y * w + x];
+			row[x * 3 + 0] = (uint8_t)(c);
+			row[x * 3 + 1] = (uint8_t)(c >> 8);
+			row[x * 3 + 2] = (uint8_t)(c >> 16);
+		}
+		std::fwrite(row.data(), 1, row.size(), f);
+	}
+	return std::fclose(f) == 0;
+}
+
+
+int main(int argc, char** argv) {
+	Options o;
+	if (!parseArgs(argc, argv, o)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+	const Scene* s = findScene(o.scene);
+	if (!s) {
+		std::fprintf(stderr, "Unknown scene: %s\n", o.scene.c_str());
+		return 1;
+	}
+	Scene scene{ *s };
+	Camera camera{ o.fov, 0.1f, 100.f };
+	camera.SetView(o.position, o.direction);
+	camera.OnResize(o.width, o.height);
+
+	Renderer renderer{ o.properties };
+	renderer.resize(o.width, o.height);
+
+	if (!o.checkpoint.empty() && renderer.loadCheckpoint(o.checkpoint.c_str(), scene, camera)) {
+		std::printf("Resumed %u frame(s) from %s\n", renderer.getAccumulatedFrames(), o.checkpoint.c_str());
+	}
+
+	using clock = std::chrono::steady_clock;
+	const clock::time_point start = clock::now();
+	for (uint32_t f = 0; f < o.frames; f++) {
+		renderer.render(scene, camera);
+		if (!o.checkpoint.empty() && o.checkpoint_every && (f + 1) % o.checkpoint_every == 0 && f + 1 < o.frames) {
+			renderer.saveCheckpoint(o.checkpoint.c_str(), scene, camera);	// skipped if the last one is still being written
+		}
+	}
+	const double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+	std::printf("Rendered %ux%u, %u frame(s) x %d spp in %.1f ms (%.1f ms/frame)\n",
+		o.width, o.height, o.frames, o.properties.pixel_samples, ms, ms / o.frames);
+
+	bool ok = false;
+	renderer.readOutput([&](const uint32_t* rgba, uint32_t w, uint32_t h) {
+		ok = writePPM(o.output, rgba, w, h);
+	});
+	if (!ok) {
+		std::fprintf(stderr, "Failed to write %s\n", o.output.c_str());
+		return 1;
+	}
+	std::printf("Wrote %s\n", o.output.c_str());
+	if (!o.checkpoint.empty()) {
+		renderer.finishCheckpoint();	// a periodic save may still be running
+		if (!renderer.saveCheckpoint(o.checkpoint.c_str(), scene, camera) || !renderer.finishCheckpoint()) {
+			std::fprintf(stderr, "Failed to write %s\n", o.checkpoint.c_str());
+			return 1;
+		}
+		std::printf("Wrote %s (%u frames)\n", o.checkpoint.c_str(), renderer.getAccumulatedFrames());
+	}
+	if (!o.stats.empty()) {
+		if (!renderer.writeStatsCSV(o.stats.c_str())) {
+			std::fprintf(stderr, "Failed to write %s\n", o.stats.c_str());
+			return 1;
+		}
+		std::printf("Wrote %s\n", o.stats.c_str());
+	}
+	return 0;
+}
\ No newline at end of file
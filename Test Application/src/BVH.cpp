@@ -0,0 +1,381 @@
+#include "BVH.h"
+
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <future>
+#include <array>
+
+
+struct BVH::BuildContext {
+	struct Ref {	// partitioned in place of the index list so that every pass streams through contiguous memory
+		AABB bounds;
+		uint32_t index;
+	};
+	std::vector<Ref>
+		refs,
+		scratch;	// parallel partitions scatter through this
+	std::atomic<uint32_t> node_count{ 1 };
+	uint32_t threads{ 1 };
+};
+struct BVH::Bin {
+	AABB bounds, centroids;
+	uint32_t count{ 0 };
+
+	inline void extend(const Bin& b) {
+		this->bounds.extend(b.bounds);
+		this->centroids.extend(b.centroids);
+		this->count += b.count;
+	}
+};
+using BinGrid = std::array<std::array<BVH::Bin, BVH::BIN_COUNT>, 3>;	// bins for each axis
+
+template<typename F>
+static void parallelChunks(uint32_t begin, uint32_t end, uint32_t chunks, F&& f) {	// f(first, last, chunk_index)
+	std::vector<std::future<void>> tasks;
+	const uint32_t step = (end - begin + chunks - 1) / chunks;
+	for (uint32_t c = 1; c < chunks; c++) {
+		const uint32_t a = std::min(end, begin + c * step);
+		tasks.emplace_back(std::async(std::launch::async, f, a, std::min(end, a + step), c));
+	}
+	f(begin, std::min(end, begin + step), 0U);
+	for (std::future<void>& t : tasks) {
+		t.wait();
+	}
+}
+
+
+void BVH::build(const std::vector<AABB>& prims) {
+	using hrc = std::chrono::high_resolution_clock;
+	const hrc::time_point start = hrc::now();
+
+	this->clear();
+	if (prims.empty()) { return; }
+
+	BuildContext ctx;
+	ctx.threads = std::max(1U, std::thread::hardware_concurrency());
+	ctx.refs.resize(prims.size());
+	if (prims.size() >= 2 * PARALLEL_THRESHOLD) {
+		ctx.scratch.resize(prims.size());
+	}
+
+	const uint32_t
+		count = (uint32_t)prims.size(),
+		chunks = std::max(1U, std::min(ctx.threads, count / PARALLEL_THRESHOLD));
+	std::vector<Bin> root(chunks);
+	parallelChunks(0, count, chunks,
+		[&ctx, &prims, &root](uint32_t a, uint32_t b, uint32_t c) {
+			for (uint32_t i = a; i < b; i++) {
+				ctx.refs[i] = { prims[i], i };
+				root[c].bounds.extend(prims[i]);
+				root[c].centroids.extend(prims[i].center());
+			}
+		}
+	);
+	for (uint32_t c = 1; c < chunks; c++) {
+		root[0].extend(root[c]);
+	}
+
+	this->nodes.resize(prims.size() * 2);	// a binary tree with at least 1 primitive per leaf never exceeds 2N - 1 nodes
+	this->nodes[0].bounds = root[0].bounds;
+	this->nodes[0].start = 0;
+	this->nodes[0].count = count;
+	this->subdivide(ctx, 0, root[0].centroids, 1, ctx.threads);
+	this->nodes.resize(ctx.node_count);
+
+	this->indices.resize(prims.size());
+	for (size_t i = 0; i < ctx.refs.size(); i++) {
+		this->indices[i] = ctx.refs[i].index;
+	}
+
+	// bookkeeping for refits
+	this->primitive_bounds = prims;
+	this->parents.resize(this->nodes.size());
+	this->leaf_of.resize(prims.size());
+	this->parents[0] = 0;
+	for (uint32_t n = 0; n < (uint32_t)this->nodes.size(); n++) {
+		const Node& node = this->nodes[n];
+		if (node.isLeaf()) {
+			for (uint32_t i = node.start; i < node.start + node.count; i++) {
+				this->leaf_of[this->indices[i]] = n;
+			}
+		} else {
+			this->parents[node.start] = this->parents[node.start + 1] = n;
+		}
+	}
+
+	this->stats.build_ms = std::chrono::duration<double, std::milli>(hrc::now() - start).count();
+	this->updateStats();
+}
+
+void BVH::subdivide(BuildContext& ctx, uint32_t n, const AABB& centroids, uint32_t depth, uint32_t threads) {
+	const uint32_t
+		start = this->nodes[n].start,
+		count = this->nodes[n].count,
+		end = start + count,
+		chunks = std::min(threads, count / PARALLEL_THRESHOLD);	// only fan out as wide as the range is worth
+	if (count <= 1 || depth >= MAX_DEPTH) { return; }
+
+	// bin the primitives by centroid along each axis
+	const glm::vec3
+		c_min = centroids.min,
+		c_ext = centroids.extent();
+	glm::vec3 scale;
+	for (int a = 0; a < 3; a++) {
+		scale[a] = c_ext[a] > 0.f ? (float)BIN_COUNT / c_ext[a] : 0.f;
+	}
+	auto bin_of = [&c_min, &scale](const glm::vec3& c, int a) {
+		return std::min(BIN_COUNT - 1, (uint32_t)((c[a] - c_min[a]) * scale[a]));
+	};
+	auto bin_range = [&ctx, &bin_of, &scale](uint32_t a, uint32_t b, BinGrid& bins) {
+		for (uint32_t i = a; i < b; i++) {
+			const AABB& bounds = ctx.refs[i].bounds;
+			const glm::vec3 c = bounds.center();
+			for (int axis = 0; axis < 3; axis++) {
+				if (scale[axis] == 0.f) { continue; }
+				Bin& bin = bins[axis][bin_of(c, axis)];
+				bin.bounds.extend(bounds);
+				bin.centroids.extend(c);
+				bin.count++;
+			}
+		}
+	};
+	BinGrid bins{};
+	if (chunks > 1) {
+		std::vector<BinGrid> part(chunks);
+		parallelChunks(start, end, chunks,
+			[&bin_range, &part](uint32_t a, uint32_t b, uint32_t c) { bin_range(a, b, part[c]); });
+		for (const BinGrid& p : part) {
+			for (int axis = 0; axis < 3; axis++) {
+				for (uint32_t i = 0; i < BIN_COUNT; i++) {
+					bins[axis][i].extend(p[axis][i]);
+				}
+			}
+		}
+	} else {
+		bin_range(start, end, bins);
+	}
+
+	// sweep the bin boundaries and evaluate the SAH for each candidate plane
+	float best_cost = std::numeric_limits<float>::infinity();
+	int best_axis = -1;
+	uint32_t best_split = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		if (scale[axis] == 0.f) { continue; }
+		float right_area[BIN_COUNT];
+		uint32_t right_count[BIN_COUNT];
+		AABB acc;
+		uint32_t num = 0;
+		for (uint32_t i = BIN_COUNT - 1; i > 0; i--) {
+			acc.extend(bins[axis][i].bounds);
+			num += bins[axis][i].count;
+			right_area[i] = acc.surfaceArea();
+			right_count[i] = num;
+		}
+		acc = AABB{};
+		num = 0;
+		for (uint32_t i = 1; i < BIN_COUNT; i++) {	// split between bin i - 1 and bin i
+			acc.extend(bins[axis][i - 1].bounds);
+			num += bins[axis][i - 1].count;
+			if (num == 0 || right_count[i] == 0) { continue; }
+			const float cost = acc.surfaceArea() * this->leafCost(num) + right_area[i] * this->leafCost(right_count[i]);	// in the same batches as the leaf cost below
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = i;
+			}
+		}
+	}
+
+	const float
+		area = this->nodes[n].bounds.surfaceArea(),
+		leaf_cost = this->leafCost(count);
+	best_cost = area > 0.f ? TRAVERSAL_COST + best_cost / area : leaf_cost;
+	if (count <= std::max(MAX_LEAF_SIZE, this->leaf_width) && leaf_cost <= best_cost) { return; }
+
+	uint32_t mid;
+	Bin left_bin, right_bin;
+	if (best_axis >= 0) {
+		auto goes_left = [&bin_of, best_axis, best_split](const BuildContext::Ref& r) { return bin_of(r.bounds.center(), best_axis) < best_split; };
+		if (chunks > 1) {	// count each chunk's left side, then scatter both sides through the scratch list in chunk order
+			std::vector<uint32_t> lefts(chunks + 1, 0U);	// before each chunk, once summed
+			parallelChunks(start, end, chunks,
+				[&ctx, &goes_left, &lefts](uint32_t a, uint32_t b, uint32_t c) {
+					lefts[c + 1] = (uint32_t)std::count_if(ctx.refs.begin() + a, ctx.refs.begin() + b, goes_left);
+				}
+			);
+			for (uint32_t c = 0; c < chunks; c++) {
+				lefts[c + 1] += lefts[c];
+			}
+			mid = start + lefts[chunks];
+			parallelChunks(start, end, chunks,
+				[&ctx, &goes_left, &lefts, start, mid](uint32_t a, uint32_t b, uint32_t c) {
+					uint32_t
+						l = start + lefts[c],
+						r = mid + (a - start) - lefts[c];
+					for (uint32_t i = a; i < b; i++) {
+						ctx.scratch[goes_left(ctx.refs[i]) ? l++ : r++] = ctx.refs[i];
+					}
+				}
+			);
+			parallelChunks(start, end, chunks,
+				[&ctx](uint32_t a, uint32_t b, uint32_t) { std::copy(ctx.scratch.begin() + a, ctx.scratch.begin() + b, ctx.refs.begin() + a); });
+		} else {
+			mid = (uint32_t)(std::partition(ctx.refs.begin() + start, ctx.refs.begin() + end, goes_left) - ctx.refs.begin());
+		}
+		for (uint32_t i = 0; i < BIN_COUNT; i++) {		// child bounds fall out of the bins, no need for another pass
+			(i < best_split ? left_bin : right_bin).extend(bins[best_axis][i]);
+		}
+	} else {	// every centroid is coincident
+		return;
+	}
+	if (mid == start || mid == end) { return; }
+
+	const uint32_t left = ctx.node_count.fetch_add(2);
+	this->nodes[left].bounds = left_bin.bounds;
+	this->nodes[left].start = start;
+	this->nodes[left].count = mid - start;
+	this->nodes[left + 1].bounds = right_bin.bounds;
+	this->nodes[left + 1].start = mid;
+	this->nodes[left + 1].count = end - mid;
+	this->nodes[n].start = left;
+	this->nodes[n].count = 0;
+
+	/* The subtrees touch disjoint ref ranges and node slots, so they can be built concurrently -- each with its share of
+	* the threads, which keeps the whole build at about one task per thread. */
+	if (chunks > 1) {
+		const uint32_t half = threads / 2;
+		std::future<void> l = std::async(std::launch::async,
+			[this, &ctx, left, &left_bin, depth, half]() { this->subdivide(ctx, left, left_bin.centroids, depth + 1, half); });
+		this->subdivide(ctx, left + 1, right_bin.centroids, depth + 1, threads - half);
+		l.wait();
+	} else {
+		this->subdivide(ctx, left, left_bin.centroids, depth + 1, threads);
+		this->subdivide(ctx, left + 1, right_bin.centroids, depth + 1, threads);
+	}
+}
+
+bool BVH::refit(uint32_t p, const AABB& b) {
+	if (p >= this->primitive_bounds.size()) { return false; }
+	this->primitive_bounds[p] = b;
+
+	uint32_t n = this->leaf_of[p];
+	for (;;) {
+		Node& node = this->nodes[n];
+		AABB updated;
+		if (node.isLeaf()) {
+			for (uint32_t i = node.start; i < node.start + node.count; i++) {
+				updated.extend(this->primitive_bounds[this->indices[i]]);
+			}
+		} else {
+			updated = this->nodes[node.start].bounds;
+			updated.extend(this->nodes[node.start + 1].bounds);
+		}
+		if (updated.min == node.bounds.min && updated.max == node.bounds.max) { break; }	// nothing above this can change either
+
+		this->weighted_area += (double)(updated.surfaceArea() - node.bounds.surfaceArea()) * this->costWeight(node);
+		node.bounds = updated;
+		if (n == 0) { break; }
+		n = this->parents[n];
+	}
+
+	const float root_area = this->nodes[0].bounds.surfaceArea();
+	this->stats.sah_cost = root_area > 0.f ? (float)(this->weighted_area / root_area) : INTERSECT_COST * this->indices.size();
+	this->stats.refits++;
+	return true;
+}
+
+bool BVH::packetCompatible(const glm::vec3* inv_d, uint32_t n) {
+	for (int a = 0; a < 3; a++) {
+		const bool negative = std::signbit(inv_d[0][a]);
+		for (uint32_t i = 1; i < n; i++) {
+			if (std::signbit(inv_d[i][a]) != negative) { return false; }
+		}
+	}
+	return true;
+}
+
+void BVH::updateStats() {
+	this->stats.nodes = (uint32_t)this->nodes.size();
+	this->stats.leaves = this->stats.depth = 0;
+	this->stats.refits = 0;
+	this->stats.sah_cost = this->stats.initial_sah_cost = this->computeSAHCost();
+	this->weighted_area = 0.0;
+	for (const Node& node : this->nodes) {
+		this->weighted_area += (double)node.bounds.surfaceArea() * this->costWeight(node);
+	}
+	if (this->nodes.empty()) { return; }
+
+	struct { uint32_t node, depth; } stack[MAX_DEPTH + 1];
+	uint32_t top = 0;
+	stack[top++] = { 0, 1 };
+	while (top > 0) {
+		const auto e = stack[--top];
+		const Node& node = this->nodes[e.node];
+		this->stats.depth = std::max(this->stats.depth, e.depth);
+		if (node.isLeaf()) {
+			this->stats.leaves++;
+		} else {
+			stack[top++] = { node.start, e.depth + 1 };
+			stack[top++] = { node.start + 1, e.depth + 1 };
+		}
+	}
+}
+float BVH::computeSAHCost() const {
+	if (this->nodes.empty()) { return 0.f; }
+	const float root_area = this->nodes[0].bounds.surfaceArea();
+	if (root_area <= 0.f) { return INTERSECT_COST * this->indices.size(); }
+	float cost = 0.f;
+	for (const Node& node : this->nodes) {
+		cost += node.bounds.surfaceArea() * this->costWeight(node);
+	}
+	return cost / root_area;
+}
+
+
+void BufferedBVH::build(const std::vector<AABB>& prims, const std::function<void(const BVH&, uint32_t)>& landing) {
+	this->wait();
+	const uint32_t spare = this->active.load() ^ 1;
+	this->slots[spare].build(prims);
+	if (landing) {
+		landing(this->slots[spare], spare);
+	}
+	this->active.store(spare, std::memory_order_release);
+	this->stale.clear();
+}
+void BufferedBVH::buildAsync(std::vector<AABB>&& prims) {
+	this->wait();
+	this->task = std::async(std::launch::async,
+		[this, p = std::move(prims)]() { this->slots[this->active.load() ^ 1].build(p); });
+}
+void BufferedBVH::refit(uint32_t i, const AABB& b, float threshold) {
+	BVH& active = this->get();
+	active.refit(i, b);
+	if (this->building()) {
+		this->stale.emplace_back(i, b);
+	} else if (active.getStats().degradation() > threshold) {
+		this->buildAsync(std::vector<AABB>{ active.getPrimitiveBounds() });
+	}
+}
+bool BufferedBVH::poll(const std::function<void(const BVH&, uint32_t)>& landing) {
+	if (this->task.valid() && this->task.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		this->task.get();
+		const uint32_t spare = this->active.load() ^ 1;
+		if (landing) {
+			landing(this->slots[spare], spare);
+		}
+		this->active.store(spare, std::memory_order_release);
+		for (const std::pair<uint32_t, AABB>& r : this->stale) {
+			this->get().refit(r.first, r.second);
+		}
+		this->stale.clear();
+		return true;
+	}
+	return false;
+}
+void BufferedBVH::wait() {
+	if (this->task.valid()) {
+		this->task.get();
+	}
+	this->stale.clear();	// already applied to the active tree
+}
\ No newline at end of file
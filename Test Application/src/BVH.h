@@ -0,0 +1,324 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <functional>
+
+#include <glm/glm.hpp>
+
+
+struct AABB {
+	glm::vec3
+		min{ std::numeric_limits<float>::infinity() },
+		max{ -std::numeric_limits<float>::infinity() };
+
+	inline void extend(const glm::vec3& p) {
+		this->min = glm::min(this->min, p);
+		this->max = glm::max(this->max, p);
+	}
+	inline void extend(const AABB& b) {
+		this->min = glm::min(this->min, b.min);
+		this->max = glm::max(this->max, b.max);
+	}
+	inline glm::vec3 center() const { return (this->min + this->max) * 0.5f; }
+	inline glm::vec3 extent() const { return this->max - this->min; }
+	inline bool valid() const
+		{ return this->min.x <= this->max.x && this->min.y <= this->max.y && this->min.z <= this->max.z; }
+	inline float surfaceArea() const {
+		if (!this->valid()) { return 0.f; }
+		glm::vec3 e = this->extent();
+		return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	// slab test -- returns the entry distance along the ray, or infinity if the box is missed within [t_min, t_max]
+	inline float intersect(const glm::vec3& origin, const glm::vec3& inv_direction, float t_min, float t_max) const {
+		glm::vec3
+			t0 = (this->min - origin) * inv_direction,
+			t1 = (this->max - origin) * inv_direction,
+			tn = glm::min(t0, t1),
+			tf = glm::max(t0, t1);
+		float
+			enter = std::max(std::max(tn.x, tn.y), std::max(tn.z, t_min)),
+			exit = std::min(std::min(tf.x, tf.y), std::min(tf.z, t_max));
+		return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+	}
+
+};
+
+
+class BVH {
+public:
+	BVH() = default;
+
+	static constexpr uint32_t
+		MAX_LEAF_SIZE = 4,
+		MAX_DEPTH = 64,
+		BIN_COUNT = 16,					// SAH candidate planes per axis
+		PARALLEL_THRESHOLD = 1U << 12;	// nodes with fewer primitives than this are built on a single thread
+	static constexpr float
+		TRAVERSAL_COST = 1.f,		// relative costs used by the surface area heuristic
+		INTERSECT_COST = 1.f;
+
+	struct Node {
+		AABB bounds;
+		uint32_t
+			start{ 0 },		// index of the left child (right child is start + 1) for interior nodes, or the first primitive for leaves
+			count{ 0 };		// number of primitives -- 0 for interior nodes
+		inline bool isLeaf() const { return this->count > 0; }
+	};
+	struct BuildStats {
+		double build_ms{ 0.0 };
+		uint32_t
+			nodes{ 0 },
+			leaves{ 0 },
+			depth{ 0 };
+		float
+			sah_cost{ 0.f },		// expected cost of a random ray against the tree, relative to a single intersection test
+			initial_sah_cost{ 0.f };	// 'sah_cost' as of the last full build -- refits only ever make the tree worse than this
+		uint32_t refits{ 0 };
+
+		inline float degradation() const { return this->initial_sah_cost > 0.f ? this->sah_cost / this->initial_sah_cost : 1.f; }
+	};
+	struct Bin;
+
+	void build(const std::vector<AABB>& primitive_bounds);
+	bool refit(uint32_t primitive, const AABB& bounds);	// updates a single primitive's bounds and propagates them up to the root
+	inline void setLeafWidth(uint32_t w) { this->leaf_width = std::max(1U, w); }	// primitives intersected per batch -- leaves are sized for SIMD kernels of this width (applies to the next build)
+	inline uint32_t getLeafWidth() const { return this->leaf_width; }
+	inline void clear() {
+		this->nodes.clear();
+		this->indices.clear();
+		this->primitive_bounds.clear();
+		this->parents.clear();
+		this->leaf_of.clear();
+		this->stats = BuildStats{};
+	}
+	inline bool empty() const { return this->nodes.empty(); }
+	inline AABB bounds() const { return this->nodes.empty() ? AABB{} : this->nodes[0].bounds; }
+
+	inline const std::vector<Node>& getNodes() const { return this->nodes; }
+	inline const std::vector<uint32_t>& getIndices() const { return this->indices; }
+	inline const std::vector<AABB>& getPrimitiveBounds() const { return this->primitive_bounds; }
+	inline const BuildStats& getStats() const { return this->stats; }
+
+	float computeSAHCost() const;
+
+	/* Walks the nodes front-to-back and invokes 'leaf_f(primitive_index)' for every primitive in a leaf that the ray reaches.
+	* The callback is expected to shrink 't_max' (which is read by reference) whenever it records a closer hit, so that farther
+	* subtrees get culled. Every node that gets visited is counted into 'visited' when it is provided. */
+	template<typename Leaf_F>
+	void traverse(const glm::vec3& origin, const glm::vec3& direction, float t_min, const float& t_max, Leaf_F&& leaf_f, uint64_t* visited = nullptr) const;
+	/* Same as above, but invokes 'leaf_f(first, count)' once per leaf with its range in 'indices' (which is also the
+	* order that leaf-packed primitive data should be laid out in). */
+	template<typename Leaf_F>
+	void traverseLeaves(const glm::vec3& origin, const glm::vec3& direction, float t_min, const float& t_max, Leaf_F&& leaf_f, uint64_t* visited = nullptr) const;
+	/* Walks the tree once for a packet of rays that share an origin, culling nodes that no ray in the packet can reach
+	* with interval arithmetic over the packet's inverse directions, which must have the same sign per axis (see
+	* packetCompatible()). Invokes 'leaf_f(first, count, leaf_bounds)' and expects it to shrink the per ray 't_max'. */
+	template<typename Leaf_F>
+	void traversePacket(const glm::vec3& origin, const glm::vec3* inv_directions, uint32_t rays,
+		float t_min, const float* t_max, Leaf_F&& leaf_f, uint64_t* visited = nullptr) const;
+	static bool packetCompatible(const glm::vec3* inv_directions, uint32_t rays);
+
+protected:
+	struct BuildContext;
+
+	void subdivide(BuildContext&, uint32_t node, const AABB& centroid_bounds, uint32_t depth, uint32_t threads);	// 'threads' that this subtree may keep busy
+	void updateStats();
+	inline float leafCost(uint32_t count) const
+		{ return INTERSECT_COST * ((count + this->leaf_width - 1) / this->leaf_width); }
+	inline float costWeight(const Node& n) const
+		{ return n.isLeaf() ? this->leafCost(n.count) : TRAVERSAL_COST; }
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> indices;	// primitive indices sorted so that each leaf references a contiguous range
+
+	std::vector<AABB> primitive_bounds;		// kept for refitting
+	std::vector<uint32_t>
+		parents,	// per node
+		leaf_of;	// per primitive
+	double weighted_area{ 0.0 };	// sum of each node's surface area times its SAH weight -- maintained through refits
+	BuildStats stats;
+	uint32_t leaf_width{ 1 };
+
+
+};
+
+
+/* Owns the BVH that gets traversed plus a spare slot which rebuilds are written into before being flipped in.
+* Rebuilds can optionally run on a worker thread, since nothing traverses the spare slot -- but refits, build() and
+* poll() change the tree that traversals read, so the owner must only call them while none are in flight (the scene
+* does between frames). Copies only carry the active tree. */
+class BufferedBVH {
+public:
+	BufferedBVH() = default;
+	inline BufferedBVH(const BufferedBVH& b) :
+		active(b.activeSlot())
+	{
+		this->slots[this->active] = b.get();
+		this->slots[this->active ^ 1].setLeafWidth(b.get().getLeafWidth());
+	}
+	inline BufferedBVH& operator=(const BufferedBVH& b) {	// keeps the source's slot index so that data kept in step with the slots stays valid
+		this->wait();
+		this->slots[b.activeSlot()] = b.get();
+		this->slots[b.activeSlot() ^ 1].setLeafWidth(b.get().getLeafWidth());
+		this->active = b.activeSlot();
+		return *this;
+	}
+	inline ~BufferedBVH() { this->wait(); }
+
+	inline const BVH& get() const { return this->slots[this->active.load(std::memory_order_acquire)]; }
+	inline BVH& get() { return this->slots[this->active.load(std::memory_order_acquire)]; }
+	inline const BVH& get(uint32_t slot) const { return this->slots[slot]; }
+	inline uint32_t activeSlot() const { return this->active.load(std::memory_order_acquire); }
+	inline void setLeafWidth(uint32_t w) {
+		this->wait();
+		this->slots[0].setLeafWidth(w);
+		this->slots[1].setLeafWidth(w);
+	}
+
+	void build(const std::vector<AABB>& primitive_bounds, const std::function<void(const BVH&, uint32_t)>& landing = nullptr);	// 'landing' as in poll()
+	void buildAsync(std::vector<AABB>&& primitive_bounds);
+	void refit(uint32_t primitive, const AABB& bounds, float rebuild_threshold);	// refits the active tree and starts a background rebuild once its SAH cost has grown past the threshold
+	/* Flips in a finished asynchronous build and catches it up with refits made in the meantime -- returns true if that happened.
+	* 'landing(tree, slot)' is invoked with the new tree just before it becomes active. */
+	bool poll(const std::function<void(const BVH&, uint32_t)>& landing = nullptr);
+	inline bool building() const { return this->task.valid(); }
+	void wait();	// blocks until any asynchronous build finishes (the result is discarded)
+
+protected:
+	BVH slots[2];
+	std::atomic<uint32_t> active{ 0 };
+	std::future<void> task;
+	std::vector<std::pair<uint32_t, AABB>> stale;	// refits made while a background build was running
+
+
+};
+
+
+template<typename Leaf_F>
+void BVH::traverse(const glm::vec3& o, const glm::vec3& d, float t_min, const float& t_max, Leaf_F&& leaf_f, uint64_t* visited) const {
+	this->traverseLeaves(o, d, t_min, t_max,
+		[this, &leaf_f](uint32_t first, uint32_t count) {
+			for (uint32_t i = first; i < first + count; i++) {
+				leaf_f(this->indices[i]);
+			}
+		},
+		visited
+	);
+}
+template<typename Leaf_F>
+void BVH::traverseLeaves(const glm::vec3& o, const glm::vec3& d, float t_min, const float& t_max, Leaf_F&& leaf_f, uint64_t* visited) const {
+	constexpr float MISS = std::numeric_limits<float>::infinity();
+	if (this->nodes.empty()) { return; }
+
+	const glm::vec3 inv_d = 1.f / d;
+	struct { uint32_t node; float enter; } stack[MAX_DEPTH];
+	uint32_t top = 0;
+
+	if (this->nodes[0].bounds.intersect(o, inv_d, t_min, t_max) == MISS) { return; }
+	uint32_t n = 0;
+	for (;;) {
+		const Node& node = this->nodes[n];
+		if (visited) { (*visited)++; }
+		if (node.isLeaf()) {
+			leaf_f(node.start, node.count);
+		} else {
+			uint32_t
+				first = node.start,
+				second = node.start + 1;
+			float
+				first_t = this->nodes[first].bounds.intersect(o, inv_d, t_min, t_max),
+				second_t = this->nodes[second].bounds.intersect(o, inv_d, t_min, t_max);
+			if (second_t < first_t) {
+				std::swap(first, second);
+				std::swap(first_t, second_t);
+			}
+			if (first_t != MISS) {
+				if (second_t != MISS) {
+					stack[top++] = { second, second_t };
+				}
+				n = first;
+				continue;
+			}
+		}
+		do {	// pop until we find a subtree that is still closer than the nearest hit
+			if (top == 0) { return; }
+			top--;
+		} while (stack[top].enter > t_max);
+		n = stack[top].node;
+	}
+}
+template<typename Leaf_F>
+void BVH::traversePacket(const glm::vec3& o, const glm::vec3* inv_d, uint32_t n, float t_min, const float* t_max, Leaf_F&& leaf_f, uint64_t* visited) const {
+	constexpr float MISS = std::numeric_limits<float>::infinity();
+	if (this->nodes.empty() || n == 0) { return; }
+
+	glm::vec3
+		inv_lo{ MISS },
+		inv_hi{ -MISS };
+	for (uint32_t i = 0; i < n; i++) {
+		inv_lo = glm::min(inv_lo, inv_d[i]);
+		inv_hi = glm::max(inv_hi, inv_d[i]);
+	}
+	auto farthest = [t_max, n]() {
+		float f = t_max[0];
+		for (uint32_t i = 1; i < n; i++) { f = std::max(f, t_max[i]); }
+		return f;
+	};
+	float packet_far = farthest();
+	auto enter = [&](const AABB& b) {	// lower bound on where any ray in the packet enters the box, or infinity if none can
+		float
+			entry = t_min,
+			exit = packet_far;
+		for (int a = 0; a < 3; a++) {
+			const bool positive = inv_lo[a] >= 0.f;
+			const float
+				near_d = (positive ? b.min[a] : b.max[a]) - o[a],
+				far_d = (positive ? b.max[a] : b.min[a]) - o[a];
+			entry = std::max(entry, std::min(near_d * inv_lo[a], near_d * inv_hi[a]));
+			exit = std::min(exit, std::max(far_d * inv_lo[a], far_d * inv_hi[a]));
+		}
+		return entry <= exit ? entry : MISS;
+	};
+
+	struct { uint32_t node; float enter; } stack[MAX_DEPTH];
+	uint32_t top = 0;
+	if (enter(this->nodes[0].bounds) == MISS) { return; }
+	uint32_t node_i = 0;
+	for (;;) {
+		const Node& node = this->nodes[node_i];
+		if (visited) { (*visited)++; }
+		if (node.isLeaf()) {
+			leaf_f(node.start, node.count, node.bounds);
+			packet_far = farthest();
+		} else {
+			uint32_t
+				first = node.start,
+				second = node.start + 1;
+			float
+				first_t = enter(this->nodes[first].bounds),
+				second_t = enter(this->nodes[second].bounds);
+			if (second_t < first_t) {
+				std::swap(first, second);
+				std::swap(first_t, second_t);
+			}
+			if (first_t != MISS) {
+				if (second_t != MISS) {
+					stack[top++] = { second, second_t };
+				}
+				node_i = first;
+				continue;
+			}
+		}
+		do {
+			if (top == 0) { return; }
+			top--;
+		} while (stack[top].enter > packet_far);
+		node_i = stack[top].node;
+	}
+}
\ No newline at end of file
@@ -1,25 +1,25 @@
 #include "Camera.h"
 
-#include <thread>
-#include <iostream>
-
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#ifndef RT_HEADLESS
 #include "Walnut/Input/Input.h"
-#include "Walnut/Random.h"
 
 
 using namespace Walnut;
+#endif
 
 Camera::Camera(float verticalFOV, float nearClip, float farClip)
 	: m_VerticalFOV(verticalFOV), m_NearClip(nearClip), m_FarClip(farClip)
 {
 	m_ForwardDirection = glm::vec3(0, 0, -1);
 	m_Position = glm::vec3(0, 0, 3);
+	RecalculateView();
 }
 
+#ifndef RT_HEADLESS
 bool Camera::OnUpdate(float ts)
 {
 	glm::vec2 mousePos = Input::GetMousePosition();
@@ -92,32 +92,28 @@ bool Camera::OnUpdate(float ts)
 	if (moved)
 	{
 		RecalculateView();
-		//RecalculateRayDirections();
-		std::thread(&Camera::RecalculateRayDirections, this).detach();
 	}
 
 	return moved;
 }
+#endif
+
+void Camera::SetView(const glm::vec3& position, const glm::vec3& direction)
+{
+	m_Position = position;
+	m_ForwardDirection = glm::normalize(direction);
+	RecalculateView();
+}
 
-void Camera::OnResize(uint32_t width, uint32_t height, uint32_t depth)
+void Camera::OnResize(uint32_t width, uint32_t height)
 {
-	if (depth > 0) depth = 1;
 	if (width == m_ViewportWidth && height == m_ViewportHeight)
-	{
-		if (depth != m_ArrayDepth)
-		{
-			//RecalculateRayDirections();
-			std::thread(&Camera::RecalculateRayDirections, this).detach();
-		}
 		return;
-	}
 
 	m_ViewportWidth = width;
 	m_ViewportHeight = height;
 
 	RecalculateProjection();
-	//RecalculateRayDirections();
-	std::thread(&Camera::RecalculateRayDirections, this).detach();
 }
 
 void Camera::OnReview(float verticalFOV, float nearClip, float farClip)
@@ -130,8 +126,6 @@ void Camera::OnReview(float verticalFOV, float nearClip, float farClip)
 	m_FarClip = farClip;
 
 	RecalculateProjection();
-	//RecalculateRayDirections();
-	std::thread(&Camera::RecalculateRayDirections, this).detach();
 }
 
 float Camera::GetRotationSpeed()
@@ -139,126 +133,32 @@ float Camera::GetRotationSpeed()
 	return 0.3f;
 }
 
+Camera::RayGenerator Camera::GetRayGenerator() const
+{
+	std::scoped_lock l(m_ViewAccess);
+
+	RayGenerator g;
+	g.m_Projection = m_Projection;
+	g.m_InverseProjection = m_InverseProjection;
+	g.m_ViewRotation = glm::mat3(m_InverseView);
+	g.m_Position = glm::vec3(m_InverseView[3]);
+	g.m_Width = m_ViewportWidth;
+	g.m_Height = m_ViewportHeight;
+	g.m_InvWidth = m_ViewportWidth ? 1.0f / m_ViewportWidth : 0.0f;
+	g.m_InvHeight = m_ViewportHeight ? 1.0f / m_ViewportHeight : 0.0f;
+	return g;
+}
+
 void Camera::RecalculateProjection()
 {
+	std::scoped_lock l(m_ViewAccess);
 	m_Projection = glm::perspectiveFov(glm::radians(m_VerticalFOV), (float)m_ViewportWidth, (float)m_ViewportHeight, m_NearClip, m_FarClip);
 	m_InverseProjection = glm::inverse(m_Projection);
 }
 
 void Camera::RecalculateView()
 {
+	std::scoped_lock l(m_ViewAccess);
 	m_View = glm::lookAt(m_Position, m_Position + m_ForwardDirection, glm::vec3(0, 1, 0));
 	m_InverseView = glm::inverse(m_View);
-}
-
-void Camera::RecalculateRayDirections()
-{
-	m_RayAccess.lock();
-	m_AA_RayAccess.lock();
-
-	std::cout << "Calculating Ray Directions..." << std::endl;
-
-	m_RayDirections.resize(m_ArrayDepth);
-	float rx = 0.f, ry = 0.f;
-
-	if (m_ArrayDepth == 0)	// theoretically pointless but still good to have
-		m_RayAccess.unlock();
-	for (size_t r = 0; r < m_ArrayDepth; r++)
-	{
-		m_RayDirections[r].resize(m_ViewportWidth * m_ViewportHeight);
-		if (r != 0)
-		{
-			rx = Random::Float();
-			ry = Random::Float();
-		}
-
-		for (uint32_t y = 0; y < m_ViewportHeight; y++)
-		{
-			for (uint32_t x = 0; x < m_ViewportWidth; x++)
-			{
-				glm::vec2 coord = { (x + rx) / (float)m_ViewportWidth, (y + ry) / (float)m_ViewportHeight };
-				coord = coord * 2.0f - 1.0f; // -1 -> 1
-
-				glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
-				m_RayDirections[r][x + y * m_ViewportWidth] =
-					glm::vec3(m_InverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0)); // World space
-			}
-		}
-
-		std::cout << "Calculated Ray Directions for array " << r << std::endl;
-
-		if (r == 0)
-			m_RayAccess.unlock();
-	}
-	m_AA_RayAccess.unlock();
-}
-
-void Camera::CalculateRandomDirections(std::vector<glm::vec3>& rays) const
-{
-	rays.resize(m_ViewportWidth * m_ViewportHeight);
-
-	float rx = Random::Float();
-	float ry = Random::Float();
-
-	for (uint32_t y = 0; y < m_ViewportHeight; y++)
-	{
-		for (uint32_t x = 0; x < m_ViewportHeight; x++)
-		{
-			glm::vec2 coord = { (x + rx) / (float)m_ViewportWidth, (y + ry) / (float)m_ViewportHeight };
-			coord = coord * 2.0f - 1.0f; // -1 -> 1
-
-			glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
-			rays[x + y * m_ViewportWidth] =
-				glm::vec3(m_InverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0));  // World space
-		}
-	}
-}
-
-void Camera::CalculateRandomDirections(std::vector<std::vector<glm::vec3>>& rays) const
-{
-	for (std::vector<glm::vec3>& rarr : rays) {
-		this->CalculateRandomDirections(rarr);
-	}
-}
-
-//void Camera::CalculateRandomDirectionsSimple(std::vector<glm::vec3>& rays) const
-//{
-//	glm::vec3 min_variance = m_RayDirections[1 + m_ViewportWidth] - m_RayDirections[0];	// the top-leftmost ray minus the one exactly 1 pixel diagonal
-//	glm::vec3 rand = min_variance * Random::Float();	// some random ray that is inbetween the top 2 top-leftmost pixel directions
-//}
-
-const std::vector<glm::vec3>& Camera::ScopedRayAccess::GetRayDirections()
-{
-	if (!locked)
-	{
-		parent->m_RayAccess.lock();
-		locked = true;
-	}
-	return parent->m_RayDirections[0];
-}
-const std::vector<std::vector<glm::vec3>>& Camera::ScopedRayAccess::GetAARayDirections()
-{
-	if (!aa_locked)
-	{
-		parent->m_AA_RayAccess.lock();
-		aa_locked = true;
-	}
-	return parent->m_RayDirections;
-}
-void Camera::ScopedRayAccess::UnlockAccess()
-{
-	if (locked)
-	{
-		parent->m_RayAccess.unlock();
-		locked = false;
-	}
-	if (aa_locked)
-	{
-		parent->m_AA_RayAccess.unlock();
-		aa_locked = false;
-	}
-}
-Camera::ScopedRayAccess::~ScopedRayAccess()
-{
-	UnlockAccess();
 }
\ No newline at end of file
@@ -1,17 +1,20 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <vector>
 #include <mutex>
 
 class Camera
 {
-	class ScopedRayAccess;
 public:
+	class RayGenerator;
+
 	Camera(float verticalFOV, float nearClip, float farClip);
 
-	bool OnUpdate(float ts);
-	void OnResize(uint32_t width, uint32_t height, uint32_t depth = 1);
+#ifndef RT_HEADLESS
+	bool OnUpdate(float ts);	// mouse/keyboard controls
+#endif
+	void SetView(const glm::vec3& position, const glm::vec3& direction);
+	void OnResize(uint32_t width, uint32_t height);
 	void OnReview(float verticalFOV, float nearClip, float farClip);
 
 	inline const glm::mat4& GetProjection() const { return m_Projection; }
@@ -24,33 +27,51 @@ public:
 
 	float GetRotationSpeed();
 
-	inline ScopedRayAccess AccessRayDirections() const { return ScopedRayAccess{this}; }
-
-	void CalculateRandomDirections(std::vector<glm::vec3>&) const;
-	void CalculateRandomDirections(std::vector<std::vector<glm::vec3>>&) const;
-	//void CalculateRandomDirectionsSimple(std::vector<glm::vec3>&) const;
+	RayGenerator GetRayGenerator() const;	// consistent snapshot of the view, safe to take while the camera is being moved
 
-	class ScopedRayAccess {
+	// Computes primary ray directions on demand -- nothing is cached per pixel
+	class RayGenerator {
 		friend class Camera;
 	public:
-		~ScopedRayAccess();
-		const std::vector<glm::vec3>& GetRayDirections();
-		const std::vector<std::vector<glm::vec3>>& GetAARayDirections();
-		void UnlockAccess();
-	protected:
-		inline ScopedRayAccess(const Camera* c) : parent(c) {}
+		inline const glm::vec3& GetPosition() const { return m_Position; }
+		inline uint32_t GetWidth() const { return m_Width; }
+		inline uint32_t GetHeight() const { return m_Height; }
+		inline bool operator==(const RayGenerator& g) const	// generates the same rays for every pixel
+		{
+			return m_Position == g.m_Position && m_ViewRotation == g.m_ViewRotation && m_InverseProjection == g.m_InverseProjection &&
+				m_Width == g.m_Width && m_Height == g.m_Height;
+		}
+
+		// world space direction through pixel (x, y), offset by 'jitter' in [0, 1) pixels from its corner
+		inline glm::vec3 GetRayDirection(uint32_t x, uint32_t y, glm::vec2 jitter = glm::vec2{ 0.f }) const
+		{
+			glm::vec2 coord = { (x + jitter.x) * m_InvWidth, (y + jitter.y) * m_InvHeight };
+			coord = coord * 2.0f - 1.0f; // -1 -> 1
+
+			glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
+			return m_ViewRotation * glm::normalize(glm::vec3(target) / target.w); // World space
+		}
+		// inverse of the above: the (unjittered) pixel coordinate that a world space point lands on, false if it is behind the camera
+		inline bool GetPixel(const glm::vec3& world, glm::vec2& pixel) const
+		{
+			glm::vec4 clip = m_Projection * glm::vec4(glm::transpose(m_ViewRotation) * (world - m_Position), 1);
+			if (clip.w <= 0.0f)
+				return false;
+			pixel = { (clip.x / clip.w * 0.5f + 0.5f) * m_Width, (clip.y / clip.w * 0.5f + 0.5f) * m_Height };
+			return true;
+		}
+
 	private:
-		const Camera* parent;
-		bool locked{ false }, aa_locked{ false };
+		glm::mat4 m_Projection{ 1.0f }, m_InverseProjection{ 1.0f };
+		glm::mat3 m_ViewRotation{ 1.0f };
+		glm::vec3 m_Position{ 0.0f };
+		uint32_t m_Width = 0, m_Height = 0;
+		float m_InvWidth = 0.0f, m_InvHeight = 0.0f;
 	};
 
-protected:
-	inline const std::vector<glm::vec3>& GetRayDirections() const { return m_RayDirections[1]; }
-	inline const std::vector<std::vector<glm::vec3>>& GetAARayDirections() const { return m_RayDirections; }
 private:
 	void RecalculateProjection();
 	void RecalculateView();
-	void RecalculateRayDirections();
 private:
 	glm::mat4 m_Projection{ 1.0f };
 	glm::mat4 m_View{ 1.0f };
@@ -64,11 +85,9 @@ private:
 	glm::vec3 m_Position{ 0.0f, 0.0f, 0.0f };
 	glm::vec3 m_ForwardDirection{ 0.0f, 0.0f, 0.0f };
 
-	// Cached ray directions
-	std::vector<std::vector<glm::vec3>> m_RayDirections;
-	mutable std::mutex m_RayAccess, m_AA_RayAccess;
+	mutable std::mutex m_ViewAccess;	// guards the matrices while the render thread snapshots them
 
 	glm::vec2 m_LastMousePosition{ 0.0f, 0.0f };
 
-	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0, m_ArrayDepth = 1;
+	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
 };
\ No newline at end of file
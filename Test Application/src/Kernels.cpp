@@ -0,0 +1,384 @@
+#include "Kernels.h"
+
+#include <cmath>
+#include <atomic>
+#include <limits>
+
+#if defined(RT_KERNELS_SSE2) || defined(RT_KERNELS_AVX2)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// MSVC allows any intrinsic in any function, GCC/Clang need the instruction set enabled per function
+#if defined(__GNUC__) || defined(__clang__)
+#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RT_TARGET_AVX2
+#endif
+
+
+static constexpr float
+	TRIANGLE_EPSILON = 1e-5f,	// same as Triangle::intersect()
+	MISS = std::numeric_limits<float>::infinity();
+
+static inline int lowestBit(int mask) {
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, (unsigned long)mask);
+	return (int)i;
+#else
+	return __builtin_ctz((unsigned)mask);
+#endif
+}
+
+
+static int32_t scalarSpheres(
+	const PackedSpheres& p, uint32_t first, uint32_t count,
+	const glm::vec3& o, const glm::vec3& d, float t_min, float& t_max
+) {
+	const float
+		*px = p[0], *py = p[1], *pz = p[2], *pr = p[3],
+		a = glm::dot(d, d);
+	int32_t hit = -1;
+	for (uint32_t i = first; i < first + count; i++) {
+		const glm::vec3 oc = o - glm::vec3{ px[i], py[i], pz[i] };
+		const float
+			b = 2.f * glm::dot(oc, d),
+			c = glm::dot(oc, oc) - (pr[i] * pr[i]),
+			disc = (b * b) - 4.f * a * c;
+		if (disc < 0.f) { continue; }
+		const float t = (sqrtf(disc) + b) / (-2.f * a);
+		if (t < t_min || t > t_max) { continue; }
+		t_max = t;
+		hit = (int32_t)i;
+	}
+	return hit;
+}
+static int32_t scalarTriangles(
+	const PackedTriangles& p, uint32_t first, uint32_t count,
+	const glm::vec3& o, const glm::vec3& d, float t_min, float& t_max, glm::vec2& uv
+) {
+	int32_t hit = -1;
+	for (uint32_t i = first; i < first + count; i++) {
+		const glm::vec3
+			v0{ p[0][i], p[1][i], p[2][i] },
+			e1{ p[3][i], p[4][i], p[5][i] },
+			e2{ p[6][i], p[7][i], p[8][i] },
+			h = glm::cross(d, e2);
+		const float a = glm::dot(e1, h);
+		if (a > -TRIANGLE_EPSILON && a < TRIANGLE_EPSILON) { continue; }
+		const float f = 1.f / a;
+		const glm::vec3 s = o - v0;
+		const float u = f * glm::dot(s, h);
+		if (u < 0.f || u > 1.f) { continue; }
+		const glm::vec3 q = glm::cross(s, e1);
+		const float v = f * glm::dot(d, q);
+		if (v < 0.f || u + v > 1.f) { continue; }
+		const float t = f * glm::dot(e2, q);
+		if (t <= TRIANGLE_EPSILON || t < t_min || t > t_max) { continue; }
+		t_max = t;
+		uv = glm::vec2{ u, v };
+		hit = (int32_t)i;
+	}
+	return hit;
+}
+
+const IntersectKernels SCALAR_KERNELS{
+	IntersectKernels::Isa_Scalar, 1, "Scalar", scalarSpheres, scalarTriangles
+};
+
+
+/* The SIMD kernels evaluate a batch of lanes with the same arithmetic as the scalar code, leave lanes that miss
+* (or lie past the end of the range) at +inf, and then pick the closest lane with a horizontal min. */
+
+#ifdef RT_KERNELS_SSE2
+static inline int32_t closestLane(__m128 t, float& t_out) {
+	__m128 m = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+	m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+	t_out = _mm_cvtss_f32(m);
+	const int mask = _mm_movemask_ps(_mm_cmpeq_ps(t, m));
+	return t_out < MISS && mask ? lowestBit(mask) : -1;
+}
+static int32_t sse2Spheres(
+	const PackedSpheres& p, uint32_t first, uint32_t count,
+	const glm::vec3& o, const glm::vec3& d, float t_min, float& t_max
+) {
+	const float dd = glm::dot(d, d);
+	const __m128
+		ox = _mm_set1_ps(o.x), oy = _mm_set1_ps(o.y), oz = _mm_set1_ps(o.z),
+		dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z),
+		four_a = _mm_set1_ps(4.f * dd),
+		neg_two_a = _mm_set1_ps(-2.f * dd),
+		two = _mm_set1_ps(2.f),
+		zero = _mm_setzero_ps(),
+		lanes = _mm_setr_ps(0.f, 1.f, 2.f, 3.f),
+		miss = _mm_set1_ps(MISS),
+		tmin = _mm_set1_ps(t_min);
+	const float *px = p[0], *py = p[1], *pz = p[2], *pr = p[3];
+	const uint32_t end = first + count;
+	int32_t hit = -1;
+	for (uint32_t i = first; i < end; i += 4) {
+		const __m128
+			cx = _mm_sub_ps(ox, _mm_loadu_ps(px + i)),
+			cy = _mm_sub_ps(oy, _mm_loadu_ps(py + i)),
+			cz = _mm_sub_ps(oz, _mm_loadu_ps(pz + i)),
+			r = _mm_loadu_ps(pr + i),
+			b = _mm_mul_ps(two, _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, dx), _mm_mul_ps(cy, dy)), _mm_mul_ps(cz, dz))),
+			c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)), _mm_mul_ps(cz, cz)), _mm_mul_ps(r, r)),
+			disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(four_a, c));
+		__m128 valid = _mm_and_ps(_mm_cmpge_ps(disc, zero), _mm_cmplt_ps(lanes, _mm_set1_ps((float)(end - i))));
+		if (!_mm_movemask_ps(valid)) { continue; }	// most batches miss entirely -- skip the sqrt and divide
+		const __m128 t = _mm_div_ps(_mm_add_ps(_mm_sqrt_ps(_mm_max_ps(disc, zero)), b), neg_two_a);
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(t, tmin));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(t, _mm_set1_ps(t_max)));
+		if (!_mm_movemask_ps(valid)) { continue; }
+		float best;
+		const int32_t lane = closestLane(_mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, miss)), best);
+		if (lane >= 0) {
+			t_max = best;
+			hit = (int32_t)i + lane;
+		}
+	}
+	return hit;
+}
+static int32_t sse2Triangles(
+	const PackedTriangles& p, uint32_t first, uint32_t count,
+	const glm::vec3& o, const glm::vec3& d, float t_min, float& t_max, glm::vec2& uv
+) {
+	const __m128
+		ox = _mm_set1_ps(o.x), oy = _mm_set1_ps(o.y), oz = _mm_set1_ps(o.z),
+		dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z),
+		eps = _mm_set1_ps(TRIANGLE_EPSILON),
+		neg_eps = _mm_set1_ps(-TRIANGLE_EPSILON),
+		zero = _mm_setzero_ps(),
+		one = _mm_set1_ps(1.f),
+		lanes = _mm_setr_ps(0.f, 1.f, 2.f, 3.f),
+		miss = _mm_set1_ps(MISS),
+		tmin = _mm_set1_ps(t_min);
+	const uint32_t end = first + count;
+	int32_t hit = -1;
+	for (uint32_t i = first; i < end; i += 4) {
+		const __m128
+			e1x = _mm_loadu_ps(p[3] + i), e1y = _mm_loadu_ps(p[4] + i), e1z = _mm_loadu_ps(p[5] + i),
+			e2x = _mm_loadu_ps(p[6] + i), e2y = _mm_loadu_ps(p[7] + i), e2z = _mm_loadu_ps(p[8] + i),
+			hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz)),
+			hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx)),
+			hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy)),
+			a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz)),
+			f = _mm_div_ps(one, a),
+			sx = _mm_sub_ps(ox, _mm_loadu_ps(p[0] + i)),
+			sy = _mm_sub_ps(oy, _mm_loadu_ps(p[1] + i)),
+			sz = _mm_sub_ps(oz, _mm_loadu_ps(p[2] + i)),
+			u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz))),
+			qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz)),
+			qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx)),
+			qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy)),
+			v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz))),
+			t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+		__m128 valid = _mm_or_ps(_mm_cmple_ps(a, neg_eps), _mm_cmpge_ps(a, eps));
+		valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+		valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+		valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, eps), _mm_cmpge_ps(t, tmin)));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(t, _mm_set1_ps(t_max)));
+		valid = _mm_and_ps(valid, _mm_cmplt_ps(lanes, _mm_set1_ps((float)(end - i))));
+		if (!_mm_movemask_ps(valid)) { continue; }
+		float best;
+		const int32_t lane = closestLane(_mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, miss)), best);
+		if (lane >= 0) {
+			alignas(16) float us[4], vs[4];
+			_mm_store_ps(us, u);
+			_mm_store_ps(vs, v);
+			t_max = best;
+			uv = glm::vec2{ us[lane], vs[lane] };
+			hit = (int32_t)i + lane;
+		}
+	}
+	return hit;
+}
+
+const IntersectKernels SSE2_KERNELS{
+	IntersectKernels::Isa_SSE2, 4, "SSE2 (4-wide)", sse2Spheres, sse2Triangles
+};
+#endif
+
+
+#ifdef RT_KERNELS_AVX2
+RT_TARGET_AVX2 static inline int32_t closestLane(__m256 t, float& t_out) {
+	__m256 m = _mm256_min_ps(t, _mm256_permute2f128_ps(t, t, 1));
+	m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+	m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+	t_out = _mm256_cvtss_f32(m);
+	const int mask = _mm256_movemask_ps(_mm256_cmp_ps(t, m, _CMP_EQ_OQ));
+	return t_out < MISS && mask ? lowestBit(mask) : -1;
+}
+RT_TARGET_AVX2 static int32_t avx2Spheres(
+	const PackedSpheres& p, uint32_t first, uint32_t count,
+	const glm::vec3& o, const glm::vec3& d, float t_min, float& t_max
+) {
+	const float dd = glm::dot(d, d);
+	const __m256
+		ox = _mm256_set1_ps(o.x), oy = _mm256_set1_ps(o.y), oz = _mm256_set1_ps(o.z),
+		dx = _mm256_set1_ps(d.x), dy = _mm256_set1_ps(d.y), dz = _mm256_set1_ps(d.z),
+		four_a = _mm256_set1_ps(4.f * dd),
+		neg_two_a = _mm256_set1_ps(-2.f * dd),
+		two = _mm256_set1_ps(2.f),
+		zero = _mm256_setzero_ps(),
+		lanes = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f),
+		miss = _mm256_set1_ps(MISS),
+		tmin = _mm256_set1_ps(t_min);
+	const float *px = p[0], *py = p[1], *pz = p[2], *pr = p[3];
+	const uint32_t end = first + count;
+	int32_t hit = -1;
+	for (uint32_t i = first; i < end; i += 8) {
+		const __m256
+			cx = _mm256_sub_ps(ox, _mm256_loadu_ps(px + i)),
+			cy = _mm256_sub_ps(oy, _mm256_loadu_ps(py + i)),
+			cz = _mm256_sub_ps(oz, _mm256_loadu_ps(pz + i)),
+			r = _mm256_loadu_ps(pr + i),
+			b = _mm256_mul_ps(two, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, dx), _mm256_mul_ps(cy, dy)), _mm256_mul_ps(cz, dz))),
+			c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, cx), _mm256_mul_ps(cy, cy)), _mm256_mul_ps(cz, cz)), _mm256_mul_ps(r, r)),
+			disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(four_a, c));
+		__m256 valid = _mm256_and_ps(_mm256_cmp_ps(disc, zero, _CMP_GE_OQ), _mm256_cmp_ps(lanes, _mm256_set1_ps((float)(end - i)), _CMP_LT_OQ));
+		if (!_mm256_movemask_ps(valid)) { continue; }
+		const __m256 t = _mm256_div_ps(_mm256_add_ps(_mm256_sqrt_ps(_mm256_max_ps(disc, zero)), b), neg_two_a);
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, tmin, _CMP_GE_OQ));
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LE_OQ));
+		if (!_mm256_movemask_ps(valid)) { continue; }
+		float best;
+		const int32_t lane = closestLane(_mm256_blendv_ps(miss, t, valid), best);
+		if (lane >= 0) {
+			t_max = best;
+			hit = (int32_t)i + lane;
+		}
+	}
+	return hit;
+}
+RT_TARGET_AVX2 static int32_t avx2Triangles(
+	const PackedTriangles& p, uint32_t first, uint32_t count,
+	const glm::vec3& o, const glm::vec3& d, float t_min, float& t_max, glm::vec2& uv
+) {
+	const __m256
+		ox = _mm256_set1_ps(o.x), oy = _mm256_set1_ps(o.y), oz = _mm256_set1_ps(o.z),
+		dx = _mm256_set1_ps(d.x), dy = _mm256_set1_ps(d.y), dz = _mm256_set1_ps(d.z),
+		eps = _mm256_set1_ps(TRIANGLE_EPSILON),
+		neg_eps = _mm256_set1_ps(-TRIANGLE_EPSILON),
+		zero = _mm256_setzero_ps(),
+		one = _mm256_set1_ps(1.f),
+		lanes = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f),
+		miss = _mm256_set1_ps(MISS),
+		tmin = _mm256_set1_ps(t_min);
+	const uint32_t end = first + count;
+	int32_t hit = -1;
+	for (uint32_t i = first; i < end; i += 8) {
+		const __m256
+			e1x = _mm256_loadu_ps(p[3] + i), e1y = _mm256_loadu_ps(p[4] + i), e1z = _mm256_loadu_ps(p[5] + i),
+			e2x = _mm256_loadu_ps(p[6] + i), e2y = _mm256_loadu_ps(p[7] + i), e2z = _mm256_loadu_ps(p[8] + i),
+			hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz)),
+			hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx)),
+			hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy)),
+			a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz)),
+			f = _mm256_div_ps(one, a),
+			sx = _mm256_sub_ps(ox, _mm256_loadu_ps(p[0] + i)),
+			sy = _mm256_sub_ps(oy, _mm256_loadu_ps(p[1] + i)),
+			sz = _mm256_sub_ps(oz, _mm256_loadu_ps(p[2] + i)),
+			u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz))),
+			qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz)),
+			qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx)),
+			qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy)),
+			v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz))),
+			t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+		__m256 valid = _mm256_or_ps(_mm256_cmp_ps(a, neg_eps, _CMP_LE_OQ), _mm256_cmp_ps(a, eps, _CMP_GE_OQ));
+		valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+		valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+		valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, eps, _CMP_GT_OQ), _mm256_cmp_ps(t, tmin, _CMP_GE_OQ)));
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LE_OQ));
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes, _mm256_set1_ps((float)(end - i)), _CMP_LT_OQ));
+		if (!_mm256_movemask_ps(valid)) { continue; }
+		float best;
+		const int32_t lane = closestLane(_mm256_blendv_ps(miss, t, valid), best);
+		if (lane >= 0) {
+			alignas(32) float us[8], vs[8];
+			_mm256_store_ps(us, u);
+			_mm256_store_ps(vs, v);
+			t_max = best;
+			uv = glm::vec2{ us[lane], vs[lane] };
+			hit = (int32_t)i + lane;
+		}
+	}
+	return hit;
+}
+
+const IntersectKernels AVX2_KERNELS{
+	IntersectKernels::Isa_AVX2, 8, "AVX2 (8-wide)", avx2Spheres, avx2Triangles
+};
+#endif
+
+
+static bool cpuHasAVX2() {
+#if !defined(RT_KERNELS_AVX2)
+	return false;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) { return false; }
+	__cpuid(info, 1);
+	const bool
+		osxsave = info[2] & (1 << 27),
+		avx = info[2] & (1 << 28);
+	if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) { return false; }	// the OS has to save the ymm registers too
+	__cpuidex(info, 7, 0);
+	return info[1] & (1 << 5);
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool IntersectKernels::supported(Isa isa) {
+	switch (isa) {
+		case Isa_Scalar: return true;
+#ifdef RT_KERNELS_SSE2
+		case Isa_SSE2: return true;
+#endif
+#ifdef RT_KERNELS_AVX2
+		case Isa_AVX2: {
+			static const bool avx2 = cpuHasAVX2();
+			return avx2;
+		}
+#endif
+		default: return false;
+	}
+}
+const IntersectKernels& IntersectKernels::get(Isa isa) {
+	switch (supported(isa) ? isa : Isa_Scalar) {
+#ifdef RT_KERNELS_SSE2
+		case Isa_SSE2: return SSE2_KERNELS;
+#endif
+#ifdef RT_KERNELS_AVX2
+		case Isa_AVX2: return AVX2_KERNELS;
+#endif
+		default: return SCALAR_KERNELS;
+	}
+}
+
+static std::atomic<const IntersectKernels*> selected{ nullptr };
+
+const IntersectKernels& IntersectKernels::active() {
+	const IntersectKernels* k = selected.load(std::memory_order_relaxed);
+	if (!k) {
+		Isa best = Isa_Scalar;
+		for (uint32_t i = Isa_Scalar; i < Isa_Count; i++) {
+			if (supported((Isa)i)) { best = (Isa)i; }
+		}
+		k = &get(best);
+		selected.store(k, std::memory_order_relaxed);
+	}
+	return *k;
+}
+bool IntersectKernels::select(Isa isa) {
+	if (!supported(isa)) { return false; }
+	selected.store(&get(isa), std::memory_order_relaxed);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+
+/* Primitive data laid out one array per component ("lanes"), in BVH leaf order so that a leaf is a single
+* contiguous run that the kernels below can load straight into SIMD registers. Every array is padded past the
+* last primitive so full-width loads at the end of a leaf stay in bounds. */
+template<uint32_t Components>
+struct PackedLanes {
+	static constexpr uint32_t
+		COMPONENTS = Components,
+		PADDING = 8;	// widest kernel
+
+	std::vector<float> data;
+	uint32_t capacity{ 0 };		// floats per component
+	std::vector<uint32_t> lane_of;	// primitive index -> lane, for in-place updates
+
+	inline void resize(uint32_t n) {
+		this->capacity = (n + 2 * PADDING - 1) / PADDING * PADDING;
+		this->data.assign((size_t)this->capacity * Components, 0.f);
+		this->lane_of.resize(n);
+	}
+	inline uint32_t size() const { return (uint32_t)this->lane_of.size(); }
+	inline float* operator[](uint32_t c) { return this->data.data() + (size_t)c * this->capacity; }
+	inline const float* operator[](uint32_t c) const { return this->data.data() + (size_t)c * this->capacity; }
+
+};
+using PackedSpheres = PackedLanes<4>;		// center x, y, z, radius
+using PackedTriangles = PackedLanes<9>;		// v0 xyz, e1 xyz, e2 xyz
+
+
+/* Ray vs. packed primitive tests. Each checks lanes [first, first + count) and returns the lane of the closest hit
+* within [t_min, t] -- shrinking 't' to it -- or -1 if nothing was hit. The triangle kernel also outputs the
+* barycentric coordinates of the hit. Results match the scalar Sphere/Triangle intersection code. */
+struct IntersectKernels {
+	enum Isa : uint32_t {
+		Isa_Scalar = 0,
+		Isa_SSE2,
+		Isa_AVX2,
+		Isa_Count
+	};
+
+	using SphereKernel = int32_t(*)(
+		const PackedSpheres&, uint32_t first, uint32_t count,
+		const glm::vec3& origin, const glm::vec3& direction, float t_min, float& t);
+	using TriangleKernel = int32_t(*)(
+		const PackedTriangles&, uint32_t first, uint32_t count,
+		const glm::vec3& origin, const glm::vec3& direction, float t_min, float& t, glm::vec2& uv);
+
+	Isa isa;
+	uint32_t width;		// primitives per batch
+	const char* name;
+	SphereKernel spheres;
+	TriangleKernel triangles;
+
+	static bool supported(Isa);		// compiled in and available on the running CPU
+	static const IntersectKernels& get(Isa);
+	static const IntersectKernels& active();	// the widest supported set unless overridden
+	static bool select(Isa);	// overrides the active set -- returns false if unsupported
+
+};
+
+// per-ISA tables, all defined in Kernels.cpp -- the AVX2 kernels enable their instruction set per function (RT_TARGET_AVX2), so the file builds without extra flags
+extern const IntersectKernels SCALAR_KERNELS;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_KERNELS_SSE2
+extern const IntersectKernels SSE2_KERNELS;
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+#define RT_KERNELS_AVX2
+extern const IntersectKernels AVX2_KERNELS;
+#endif
\ No newline at end of file
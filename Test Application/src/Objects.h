@@ -16,7 +16,7 @@ inline static const Scene
 		std::make_shared<Quad>(glm::vec3{0, 0, 0}, glm::vec3{1, 0, 0}, glm::vec3{1, 0, 1}, glm::vec3{0, 0, 1}),
 		std::make_shared<Sphere>(glm::vec3{-1, -0.5, -1}, 0.5, PhysicalBase::DEFAULT.get(), StaticColor::DEFAULT.get(), 2.f),
 		std::make_shared<Sphere>(glm::vec3{-4.f, 3.f, 2.f}, 1.f, PhysicalBase::DEFAULT.get(), StaticColor::DEFAULT.get(), 2.f)
-	}/*,
+	},
 	frc_field{
 		std::make_unique<Quad>(
 			glm::vec3(-0.139,295.133,38.126),
@@ -259,4 +259,4 @@ inline static const Scene
 			glm::vec3(328.762635833808,183.475035778737,92.2838184339138),
 			glm::vec3(334.83090860604,181.145644106692,92.2838184339138)
 		)
-	}*/;
\ No newline at end of file
+	};
\ No newline at end of file
@@ -1,12 +1,18 @@
 #include "Renderer.h"
 
-#include <execution>
-#include <iterator>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cfloat>
+#include <cstdio>
+#include <string>
+
+#include <glm/gtc/constants.hpp>
 //#include <iostream>
 
+#ifndef RT_HEADLESS
 #include <imgui.h>
-
-#include "Walnut/Random.h"
+#endif
 
 
 uint32_t vec2rgba(glm::vec4 c) {
@@ -35,63 +41,241 @@ glm::vec4 rgba2vec(uint32_t* c) {
 
 bool Renderer::resize(uint32_t w, uint32_t h) {
 
-	this->render_interrupt = true;
-	
-	this->buffer_read_lock.lock();	// disallow both reading and writing while reallocating buffers
-	this->buffer_write_lock.lock();
+	if (!this->buffer.empty() && this->width == w && this->height == h) {
+		return false;
+	}
+	this->render_interrupt = true;	// the buffers are only touched by the render thread, and published frames keep their own size
+	this->width = w;
+	this->height = h;
+
+	const size_t pixels = (size_t)w * h;
+	this->buffer.resize(pixels);
+	this->accumulated_samples.resize(pixels);
+	this->accumulated_squares.resize(pixels);
+	this->accumulated_pixel_frames.resize(pixels);
+	this->reprojected_samples.clear();		// sized once reprojection is used
+	this->reprojected_squares.clear();
+	this->reprojected_pixel_frames.clear();
+	this->accumulated_frames = 1;
+	this->history_stale = true;
+
+	return true;
 
-	if (this->image) {
-		if (this->image->GetWidth() == w && this->image->GetHeight() == h) {
-			this->buffer_read_lock.unlock();
-			this->buffer_write_lock.unlock();
-			return false;
+}
+void Renderer::readOutput(const std::function<void(const uint32_t*, uint32_t, uint32_t)>& f) const {
+
+	if (this->output_middle.load(std::memory_order_relaxed) & OUTPUT_FRESH) {	// take the newer frame, leaving the old slot to be written
+		this->output_front = this->output_middle.exchange(this->output_front, std::memory_order_acq_rel) & ~OUTPUT_FRESH;
+	}
+	const OutputSlot& out = this->output_slots[this->output_front];
+	if (!out.rgba.empty()) {
+		f(out.rgba.data(), out.width, out.height);
+	}
+
+}
+void Renderer::publishOutput() {
+	OutputSlot& out = this->output_slots[this->output_back];
+	out.rgba.assign(this->buffer.begin(), this->buffer.end());	// reuses the slot's allocation unless the size grew
+	out.width = this->width;
+	out.height = this->height;
+	this->output_back = this->output_middle.exchange(this->output_back | OUTPUT_FRESH, std::memory_order_acq_rel) & ~OUTPUT_FRESH;
+}
+void Renderer::readStats(const std::function<void(const std::deque<FrameStats>&)>& f) const {
+	std::scoped_lock l(this->stats_lock);
+	f(this->stats_history);
+}
+bool Renderer::writeStatsCSV(const char* path) const {
+	FILE* out = std::fopen(path, "w");
+	if (!out) { return false; }
+	std::scoped_lock l(this->stats_lock);
+	size_t threads = 0, depths = 0;		// columns have to cover every frame
+	for (const FrameStats& f : this->stats_history) {
+		threads = std::max(threads, f.busy_ms.size());
+		depths = std::max(depths, std::min<size_t>(f.bounce_limit + 1, STATS_DEPTHS));
+	}
+	std::fprintf(out, "frame,frame_ms,passes,threads,bounce_limit,pixels,rays,shadow_rays,primitive_tests,nodes_visited,luminance_exits,roulette_exits,cached_hits,intersect_ms,shade_ms");
+	for (size_t d = 0; d < depths; d++) { std::fprintf(out, ",rays_depth_%zu", d); }
+	for (size_t t = 0; t < threads; t++) { std::fprintf(out, ",thread_%zu_busy_ms,thread_%zu_idle_ms", t, t); }
+	std::fprintf(out, "\n");
+	for (const FrameStats& f : this->stats_history) {
+		std::fprintf(out, "%u,%.4f,%u,%zu,%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.4f,%.4f",
+			f.frame, f.frame_ms, f.passes, f.busy_ms.size(), f.bounce_limit,
+			(unsigned long long)f.pixels, (unsigned long long)f.trace.rays, (unsigned long long)f.shadow_rays, (unsigned long long)f.trace.primitive_tests,
+			(unsigned long long)f.trace.nodes_visited, (unsigned long long)f.luminance_exits,
+			(unsigned long long)f.roulette_exits, (unsigned long long)f.cached_hits, f.intersect_ms, f.shade_ms);
+		for (size_t d = 0; d < depths; d++) { std::fprintf(out, ",%llu", (unsigned long long)f.depth_rays[d]); }
+		for (size_t t = 0; t < threads; t++) {
+			if (t < f.busy_ms.size()) {
+				std::fprintf(out, ",%.4f,%.4f", f.busy_ms[t], std::max(f.frame_ms - f.busy_ms[t], 0.));
+			} else {
+				std::fprintf(out, ",,");
+			}
 		}
-		this->image->Resize(w, h);
+		std::fprintf(out, "\n");
 	}
-	else {
-		this->image = std::make_shared<Walnut::Image>(w, h, Walnut::ImageFormat::RGBA);
+	return std::fclose(out) == 0;
+}
+
+/* Checkpoint file: the header below, then the per-pixel samples, squares and frame counts as they are laid out in
+* memory (native byte order). */
+struct CheckpointHeader {
+	char magic[4];
+	uint32_t version, width, height;
+	uint64_t fingerprint;
+	uint32_t accumulated_frames, frame_count, seed, sampler;
+};
+static constexpr char CHECKPOINT_MAGIC[4] = { 'R', 'T', 'C', 'P' };
+static constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+static inline uint64_t fnv1a(uint64_t h, const void* data, size_t bytes) {
+	const uint8_t* b = (const uint8_t*)data;
+	for (size_t i = 0; i < bytes; i++) {
+		h = (h ^ b[i]) * 0x100000001b3ULL;
 	}
+	return h;
+}
+template<typename T>
+static inline uint64_t fnv1a(uint64_t h, const std::vector<T>& v) {
+	return fnv1a(h, v.data(), v.size() * sizeof(T));
+}
+static uint64_t surfacesHash(uint64_t h, const PrimitiveStore::Surfaces& s) {
+	h = fnv1a(h, s.material);
+	h = fnv1a(h, s.texture);
+	return fnv1a(h, s.luminance);
+}
 
-	delete[] this->buffer;
-	this->buffer = new uint32_t[w * h];
-	delete[] this->accumulated_samples;
-	this->accumulated_samples = new glm::vec3[w * h];
-	this->accumulated_frames = 1;
+uint64_t Renderer::fingerprint(const Scene& scene, const Camera::RayGenerator& gen) const {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const PrimitiveStore& ps = scene.getPrimitives();	// geometry and surface IDs -- material parameters aren't covered
+	const PrimitiveStore::Spheres& sp = ps.getSpheres();
+	for (const std::vector<float>* v : { &sp.x, &sp.y, &sp.z, &sp.radius }) {
+		h = fnv1a(h, *v);
+	}
+	h = surfacesHash(h, sp);
+	const PrimitiveStore::Triangles& tr = ps.getTriangles();
+	for (const std::vector<float>* v : { &tr.v0x, &tr.v0y, &tr.v0z, &tr.e1x, &tr.e1y, &tr.e1z, &tr.e2x, &tr.e2y, &tr.e2z }) {
+		h = fnv1a(h, *v);
+	}
+	h = surfacesHash(h, tr);
+	h = fnv1a(h, ps.getInstances().inverse);
+	h = surfacesHash(h, ps.getInstances());
+	h = fnv1a(h, &scene.sky_color, sizeof(glm::vec3));
 
-	this->buffer_read_lock.unlock();
-	this->buffer_write_lock.unlock();
+	const uint32_t w = gen.GetWidth(), ht = gen.GetHeight();
+	const glm::vec3 view[4] = {		// the corners and center rays pin down the view
+		gen.GetPosition(),
+		gen.GetRayDirection(0, 0),
+		gen.GetRayDirection(w - 1, ht - 1),
+		gen.GetRayDirection(w / 2, ht / 2)
+	};
+	h = fnv1a(h, view, sizeof(view));
 
-	return true;
+	const Properties& p = this->properties;
+	const int32_t settings[6] = {
+		p.pixel_samples, p.bounce_limit, p.roulette_depth, p.recursive_samples,
+		p.render_flags & (RenderMode_AA_Random | RenderMode_Recursive_Samples),
+		(int32_t)(w * ht)
+	};
+	return fnv1a(h, settings, sizeof(settings));
+}
+bool Renderer::saveCheckpoint(const char* path, const Scene& scene, const Camera& cam) {
+	if (this->accumulated_frames == 1 || this->buffer.empty()) {
+		return false;
+	}
+	if (this->checkpoint_write.valid() && this->checkpoint_write.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+		return false;
+	}
+	CheckpointHeader header;
+	std::copy(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + 4, header.magic);
+	header.version = CHECKPOINT_VERSION;
+	header.width = this->width;
+	header.height = this->height;
+	header.fingerprint = this->fingerprint(scene, cam.GetRayGenerator());
+	header.accumulated_frames = this->accumulated_frames;
+	header.frame_count = this->frame_count;
+	header.seed = (uint32_t)this->properties.seed;
+	header.sampler = (uint32_t)this->properties.sampler;
+	std::vector<glm::vec3>
+		samples{ this->accumulated_samples.begin(), this->accumulated_samples.end() },
+		squares{ this->accumulated_squares.begin(), this->accumulated_squares.end() };
+	std::vector<uint32_t> frames{ this->accumulated_pixel_frames.begin(), this->accumulated_pixel_frames.end() };
 
+	this->checkpoint_write = std::async(std::launch::async,
+		[header, samples = std::move(samples), squares = std::move(squares), frames = std::move(frames), file = std::string{ path }]() {
+			const std::string tmp = file + ".tmp";	// written next to the old checkpoint, which is only replaced once this is complete
+			FILE* out = std::fopen(tmp.c_str(), "wb");
+			if (!out) { return false; }
+			bool ok =
+				std::fwrite(&header, sizeof(header), 1, out) == 1 &&
+				std::fwrite(samples.data(), sizeof(glm::vec3), samples.size(), out) == samples.size() &&
+				std::fwrite(squares.data(), sizeof(glm::vec3), squares.size(), out) == squares.size() &&
+				std::fwrite(frames.data(), sizeof(uint32_t), frames.size(), out) == frames.size();
+			ok = (std::fclose(out) == 0) && ok;
+			if (!ok) {
+				std::remove(tmp.c_str());
+				return false;
+			}
+			std::remove(file.c_str());	// rename() doesn't replace files everywhere
+			return std::rename(tmp.c_str(), file.c_str()) == 0;
+		}
+	);
+	return true;
+}
+bool Renderer::loadCheckpoint(const char* path, const Scene& scene, const Camera& cam) {
+	if (this->buffer.empty()) {
+		return false;
+	}
+	FILE* in = std::fopen(path, "rb");
+	if (!in) { return false; }
+	const Camera::RayGenerator gen = cam.GetRayGenerator();
+	const uint32_t pixels = this->width * this->height;
+	CheckpointHeader header;
+	std::vector<glm::vec3> samples(pixels), squares(pixels);
+	std::vector<uint32_t> frames(pixels);
+	bool ok =		// read in full before anything is replaced
+		std::fread(&header, sizeof(header), 1, in) == 1 &&
+		std::equal(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + 4, header.magic) &&
+		header.version == CHECKPOINT_VERSION &&
+		header.width == this->width && header.height == this->height &&
+		header.accumulated_frames > 1;
+	if (ok) {	// the seed and sampler don't change the fingerprint
+		const int32_t seed = this->properties.seed, sampler = this->properties.sampler;
+		this->properties.seed = (int32_t)header.seed;
+		this->properties.sampler = (int32_t)header.sampler;
+		ok = header.fingerprint == this->fingerprint(scene, gen);
+		if (!ok) {
+			this->properties.seed = seed;
+			this->properties.sampler = sampler;
+		}
+	}
+	ok = ok &&
+		std::fread(samples.data(), sizeof(glm::vec3), pixels, in) == pixels &&
+		std::fread(squares.data(), sizeof(glm::vec3), pixels, in) == pixels &&
+		std::fread(frames.data(), sizeof(uint32_t), pixels, in) == pixels;
+	std::fclose(in);
+	if (!ok) {
+		return false;
+	}
+	std::copy(samples.begin(), samples.end(), this->accumulated_samples.begin());
+	std::copy(squares.begin(), squares.end(), this->accumulated_squares.begin());
+	std::copy(frames.begin(), frames.end(), this->accumulated_pixel_frames.begin());
+	this->accumulated_frames = header.accumulated_frames;
+	this->frame_count = header.frame_count;		// keys the generators, so the next frame draws what it would have
+	for (uint32_t i = 0; i < pixels; i++) {
+		const uint32_t n = this->accumulated_pixel_frames[i];
+		this->buffer[i] = vec2rgba(n ? glm::sqrt(this->accumulated_samples[i] / (float)n) : glm::vec3{ 0.f }, 1.f);
+	}
+	this->primary_stale = true;
+	this->history_stale = true;
+	this->motion_view = gen;
+	this->stride = 1;
+	this->publishOutput();
+	return true;
+}
+bool Renderer::finishCheckpoint() {
+	return this->checkpoint_write.valid() && this->checkpoint_write.get();
 }
-std::shared_ptr<Walnut::Image> Renderer::getOutput() const {
-	
-	if (this->properties.render_flags & RenderMode_Sync_Frame) {
-		std::scoped_lock l(this->frame_lock);	// blocks until frame is not being written to
-		return this->image;
-	}
-	if (this->buffer) {
-		this->buffer_read_lock.lock();
-		this->image->SetData(this->buffer);
-		this->buffer_read_lock.unlock();
-	}
-	return this->image;
-
-}
-//std::shared_ptr<Walnut::Image> Renderer::getImmediateOutput() const {
-//	
-//	if (this->sync_lock.try_lock()) {
-//		if (this->buffer_read_lock.try_lock()) {
-//			if (this->buffer) {
-//				this->image->SetData(this->buffer);	// only sets data if able to read buffer and frame is synced
-//			}
-//			this->buffer_read_lock.unlock();
-//		}
-//		this->sync_lock.unlock();
-//	}
-//	return this->image;
-//
-//}
+#ifndef RT_HEADLESS
 bool Renderer::invokeGuiOptions() {
 	Properties& p = this->properties;
 	bool r = false;
@@ -101,143 +285,485 @@ bool Renderer::invokeGuiOptions() {
 	r |= ImGui::CheckboxFlags("Parallelize Rendering", &p.render_flags, RenderMode_Parallelize);
 	r |= ImGui::CheckboxFlags("Render Unshaded", &p.render_flags, RenderMode_Unshaded);
 	r |= ImGui::CheckboxFlags("MultiSample Recursively", &p.render_flags, RenderMode_Recursive_Samples);
+	r |= ImGui::CheckboxFlags("Trace Primary Ray Packets", &p.render_flags, RenderMode_Packets);
+	r |= ImGui::CheckboxFlags("Wavefront Path Tracing", &p.render_flags, RenderMode_Wavefront);
+	r |= ImGui::CheckboxFlags("Reproject on Camera Motion", &p.render_flags, RenderMode_Reproject);
+	ImGui::CheckboxFlags("Dynamic Resolution", &p.render_flags, RenderMode_Dynamic_Resolution);
+	ImGui::CheckboxFlags("Time Budgeted Frames", &p.render_flags, RenderMode_Time_Budget);
+	ImGui::DragFloat("Target Frame Time (ms)", &p.target_frame_ms, 0.5f, 1.f, 1000.f, "%.1f", ImGuiSliderFlags_Logarithmic | ImGuiSliderFlags_AlwaysClamp);
 	r |= ImGui::DragInt("Max Bounces", &p.bounce_limit, 1.f, 1, 20, "%d", ImGuiSliderFlags_AlwaysClamp);
+	r |= ImGui::DragInt("Russian Roulette Depth", &p.roulette_depth, 1.f, 0, 20, "%d", ImGuiSliderFlags_AlwaysClamp);
 	r |= ImGui::DragInt("Samples per Pixel", &p.pixel_samples, 1.f, 1, 500, "%d", ImGuiSliderFlags_Logarithmic | ImGuiSliderFlags_AlwaysClamp);
 	r |= ImGui::DragInt("Recursive Samples", &p.recursive_samples, 1.f, 1, 10, "%d", ImGuiSliderFlags_AlwaysClamp);
 	r |= ImGui::DragInt("AA Random Rays", &p.aa_random_rays, 1.f, 1, 10, "%d", ImGuiSliderFlags_AlwaysClamp);
+	r |= ImGui::DragInt("Seed", &p.seed);
+	if (ImGui::BeginCombo("Sampler", Rng::SEQUENCE_NAMES[std::clamp<int32_t>(p.sampler, 0, Rng::Sequence_Count - 1)])) {
+		for (int32_t i = 0; i < (int32_t)Rng::Sequence_Count; i++) {
+			if (ImGui::Selectable(Rng::SEQUENCE_NAMES[i], i == p.sampler)) {
+				p.sampler = i;
+				r = true;
+			}
+		}
+		ImGui::EndCombo();
+	}
+	ImGui::DragInt("CPU Threads", &p.cpu_threads, 0.1f, 1, (int)ThreadPool::hardwareThreads() * 2, "%d", ImGuiSliderFlags_AlwaysClamp);	// scheduling only -- the image is unaffected
+	ImGui::DragInt("Tile Size", &p.tile_size, 1.f, 4, 256, "%d", ImGuiSliderFlags_AlwaysClamp);
+	ImGui::CheckboxFlags("Pin Threads to Cores", &p.render_flags, RenderMode_Pin_Threads);
+	ImGui::CheckboxFlags("Adaptive Sampling", &p.render_flags, RenderMode_Adaptive);		// only changes where future samples go
+	ImGui::DragFloat("Adaptive Threshold", &p.adaptive_threshold, 0.0001f, 0.0001f, 0.1f, "%.4f", ImGuiSliderFlags_Logarithmic | ImGuiSliderFlags_AlwaysClamp);
+	ImGui::DragInt("Adaptive Min Frames", &p.adaptive_min_frames, 1.f, 2, 256, "%d", ImGuiSliderFlags_AlwaysClamp);
+	ImGui::DragInt("Reprojected History", &p.reproject_history, 1.f, 1, 256, "%d", ImGuiSliderFlags_AlwaysClamp);	// only applies to the next camera move
+	if (ImGui::BeginCombo("Intersection Kernels", IntersectKernels::active().name)) {
+		for (uint32_t i = 0; i < IntersectKernels::Isa_Count; i++) {
+			const IntersectKernels::Isa isa = (IntersectKernels::Isa)i;
+			if (IntersectKernels::supported(isa) &&
+				ImGui::Selectable(IntersectKernels::get(isa).name, isa == IntersectKernels::active().isa))
+			{
+				r |= IntersectKernels::select(isa);		// BVH leaves stay sized for the previous width until the next rebuild
+			}
+		}
+		ImGui::EndCombo();
+	}
 	if (ImGui::Button("Reset Options")) {
 		this->properties = Properties{};
 		r = true;
 	}
+	if (ImGui::CollapsingHeader("Profiling")) {
+		const uint64_t pixels = (uint64_t)this->width * this->height;
+		this->readStats([pixels](const std::deque<FrameStats>& history) {
+			if (history.empty()) {
+				ImGui::Text("No completed frames yet");
+				return;
+			}
+			const FrameStats& f = history.back();
+			const double rays = (double)std::max<uint64_t>(f.trace.rays, 1);
+			ImGui::Text("Frame %u: %.2f ms, %u pass(es), %.2f Mrays/s", f.frame, f.frame_ms, f.passes, f.trace.rays / (f.frame_ms * 1e3));
+			ImGui::Text("Per ray: %.1f primitive tests, %.1f BVH nodes", f.trace.primitive_tests / rays, f.trace.nodes_visited / rays);
+			ImGui::Text("Pixels traced: %llu (%.1f%%), primary hits cached: %llu", (unsigned long long)f.pixels, pixels ? 100. * f.pixels / pixels : 0., (unsigned long long)f.cached_hits);
+			ImGui::Text("Shadow rays: %llu", (unsigned long long)f.shadow_rays);
+			ImGui::Text("Luminance early-outs: %llu, russian roulette: %llu", (unsigned long long)f.luminance_exits, (unsigned long long)f.roulette_exits);
+			ImGui::Text("Thread time: %.2f ms intersecting, %.2f ms shading", f.intersect_ms, f.shade_ms);
+
+			float depths[STATS_DEPTHS], times[STATS_HISTORY];
+			const int
+				nd = (int)std::min<uint32_t>(f.bounce_limit + 1, STATS_DEPTHS),
+				nt = (int)history.size();
+			for (int d = 0; d < nd; d++) { depths[d] = (float)f.depth_rays[d]; }
+			for (int t = 0; t < nt; t++) { times[t] = (float)history[t].frame_ms; }
+			ImGui::PlotHistogram("Rays per Bounce", depths, nd, 0, nullptr, 0.f, FLT_MAX, ImVec2{ 0.f, 60.f });
+			ImGui::PlotLines("Frame Time (ms)", times, nt, 0, nullptr, 0.f, FLT_MAX, ImVec2{ 0.f, 60.f });
+			for (size_t t = 0; t < f.busy_ms.size(); t++) {		// busy share of the frame per thread
+				char label[64];
+				std::snprintf(label, sizeof(label), "%.2f ms busy, %.2f ms idle", f.busy_ms[t], std::max(f.frame_ms - f.busy_ms[t], 0.));
+				ImGui::ProgressBar((float)(f.busy_ms[t] / f.frame_ms), ImVec2{ -FLT_MIN, 0.f }, label);
+			}
+		});
+		if (ImGui::Button("Dump to CSV")) {
+			this->writeStatsCSV("render_stats.csv");
+		}
+		ImGui::SameLine();
+		ImGui::Text("(render_stats.csv, last %u frames)", STATS_HISTORY);
+	}
 	return r;
 }
+#endif
 
 
-class IndexIterator {
-public:
-	using iterator_category = std::forward_iterator_tag;
-	using value_type = int64_t;
-	using difference_type = int64_t;
-	using pointer = int64_t*;
-	using reference = int64_t&;
-
-	inline IndexIterator(int64_t v = 0) : val(v) {}
-
-	inline value_type operator*() { return this->val; }
-	inline IndexIterator& operator++() {
-		this->val++;
-		return *this;
+static inline glm::vec2 pixelJitter(int32_t flags, Rng& rng) {	// random subpixel offset for antialiasing
+	return (flags & Renderer::RenderMode_AA_Random) ? rng.Float2() : glm::vec2{ 0.f };
+}
+static inline uint64_t nanoseconds() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+static uint64_t clockOverhead() {	// cost of a back to back pair of reads, taken out of every timed sample
+	uint64_t best = ~0ULL;
+	for (int i = 0; i < 64; i++) {
+		const uint64_t start = nanoseconds();
+		best = std::min(best, nanoseconds() - start);
 	}
-	inline bool operator==(const IndexIterator& o) {
-		return this->val == o.val;
+	return best;
+}
+static inline bool timedIntersect(const Scene& s, const Ray& r, Hit& hit, Renderer::ThreadStats& stats) {
+	if (!stats.timeNext()) {
+		return s.intersect(r, hit, 1e-5f, std::numeric_limits<float>::infinity(), &stats.trace);
 	}
-	inline bool operator!=(const IndexIterator& o) {
-		return this->val != o.val;
+	static const uint64_t overhead = clockOverhead();
+	const uint64_t start = nanoseconds();
+	const bool h = s.intersect(r, hit, 1e-5f, std::numeric_limits<float>::infinity(), &stats.trace);
+	const uint64_t elapsed = nanoseconds() - start;
+	stats.intersect_ns += (elapsed > overhead ? elapsed - overhead : 0) * Renderer::STATS_TIMING_STRIDE;
+	return h;
+}
+static inline bool traceRay(const Scene& s, const Ray& r, Hit& hit, Renderer::ThreadStats& stats, size_t b) {
+	stats.traced(b);
+	return timedIntersect(s, r, hit, stats);
+}
+static inline bool luminanceExit(const glm::vec3& clr, float lum, Renderer::ThreadStats& stats) {	// bright enough that further bounces won't matter
+	const bool exit = ((clr.r + clr.g + clr.b) / 3.f * lum) >= 1.f;
+	stats.luminance_exits += exit;
+	return exit;
+}
+static inline bool survive(glm::vec3& throughput, Rng& rng, Renderer::ThreadStats& stats) {	// russian roulette -- survivors are scaled up by what the dropped paths would have added
+	const float q = std::min(std::max(throughput.r, std::max(throughput.g, throughput.b)), 0.95f);
+	if (rng.Float() >= q) {
+		stats.roulette_exits++;
+		return false;
 	}
+	throughput /= q;
+	return true;
+}
+static inline float emissionWeight(const Scene& s, const Ray& r, const Hit& hit, float bsdf_pdf) {	// power heuristic against light sampling
+	if (bsdf_pdf <= 0.f) {
+		return 1.f;
+	}
+	const float light_pdf = s.lightPdf(r.origin, hit);
+	return bsdf_pdf * bsdf_pdf / (bsdf_pdf * bsdf_pdf + light_pdf * light_pdf);
+}
 
-private:
-	int64_t val;
-
-
-};
-
-
-void Renderer::render(const Scene& scene, const Camera& cam) {
+bool Renderer::updatePrimaryCache(const Scene& scene, const Camera::RayGenerator& gen, int32_t flags) {
+	if (flags & RenderMode_AA_Random) {	// every frame jitters its camera rays
+		return false;
+	}
+	const size_t pixels = (size_t)this->width * this->height;
+	if (this->primary_stale.exchange(false) || this->primary_scene != &scene || !(this->primary_view == gen) || this->primary_frames.size() != pixels) {
+		this->primary_hits.resize(pixels);
+		this->primary_frames.assign(pixels, 0U);
+		this->primary_view = gen;
+		this->primary_scene = &scene;
+	}
+	return true;
+}
+void Renderer::primaryHit(const Scene& scene, const Ray& ray, uint32_t idx, Hit& hit, ThreadStats& stats) {
+	if (this->primaryCached(idx)) {
+		hit = this->primary_hits[idx];
+		stats.cached_hits++;
+		return;
+	}
+	hit = Hit{};
+	traceRay(scene, ray, hit, stats, stats.bounce_limit);
+	if (this->primary_cache) {	// every caller looks a pixel up once per frame, so no other thread touches the entry
+		this->primary_hits[idx] = hit;
+		this->primary_frames[idx] = this->frame_count + 1;
+	}
+}
 
-	this->render_interrupt = false;
-	int32_t flags_cache = this->properties.render_flags;
-	Camera::ScopedRayAccess ray_access = cam.AccessRayDirections();
-	auto& rays = ray_access.GetRayDirections();
+void Renderer::reproject(const Scene& scene, const Camera::RayGenerator& gen, int32_t flags) {
+	const uint32_t width = this->width, height = this->height;
+	const bool stale = this->history_stale.exchange(false) || this->history_hits.size() != (size_t)width * height;
+	if (!stale && this->history_view == gen) {
+		return;
+	}
+	const bool warp = !stale && this->accumulated_frames > 1;	// otherwise there is nothing to keep, only the depths to update
+	if (warp) {
+		this->reprojected_samples.resize((size_t)width * height);
+		this->reprojected_squares.resize((size_t)width * height);
+		this->reprojected_pixel_frames.resize((size_t)width * height);
+	}
+	uint32_t cap = (uint32_t)std::max(this->properties.reproject_history, 1);
+	if (flags & RenderMode_Adaptive) {
+		cap = std::min(cap, (uint32_t)std::max(this->properties.adaptive_min_frames - 1, 1));	// moved pixels can't count as converged right away
+	}
+	const Camera::RayGenerator& prev = this->history_view;
+	this->reprojected_hits.resize((size_t)width * height);
 
-	this->buffer_write_lock.lock();
-	if (flags_cache & RenderMode_Parallelize) {
-		/*std::cout << cam.GetRayDirections().size() << std::endl;*/
-		std::for_each(std::execution::par, IndexIterator(0), IndexIterator(this->image->GetHeight()),
-			[&scene, &cam, rays, &flags_cache, this](int64_t idx) {		// for each row...
-				glm::vec3 clr;
-				const int64_t end = this->image->GetWidth() * (idx + 1);
-				for (idx *= this->image->GetWidth(); idx < end; idx++) {	// for each pixel in the row...
-					if (this->render_interrupt) {
-						return;
+	const auto row = [&](uint32_t y, ThreadStats& stats) {
+		for (uint32_t x = 0; x < width; x++) {
+			const uint32_t idx = y * width + x;
+			const Ray ray{ gen.GetPosition(), gen.GetRayDirection(x, y) };	// the same ray as unjittered frames, so the hit can go into their cache
+			Hit hit;
+			traceRay(scene, ray, hit, stats, stats.bounce_limit);
+			const bool miss = hit.type == Primitive_Count;
+			this->reprojected_hits[idx] = HistoryHit{ hit.ptime, hit.type, hit.primitive };
+			if (this->primary_cache) {
+				this->primary_hits[idx] = hit;
+				this->primary_frames[idx] = this->frame_count;	// counts as an earlier frame, this pass is done before any path reads it
+			}
+			if (!warp) {
+				continue;
+			}
+			/* Bilinear over the four old samples around where the hit lands, leaving out those on another surface. Rounding to
+			* the nearest one instead would shift the image by up to half a pixel on every move, which adds up over a path. */
+			glm::vec3 mean{ 0.f }, square{ 0.f };
+			float frames = 0.f, weight = 0.f;
+			glm::vec2 p;
+			if (prev.GetPixel(miss ? prev.GetPosition() + ray.direction : hit.normal.origin, p)) {	// misses only depend on the direction
+				const int32_t x0 = (int32_t)std::floor(p.x), y0 = (int32_t)std::floor(p.y);
+				const glm::vec2 f = p - glm::vec2{ (float)x0, (float)y0 };
+				for (uint32_t tap = 0; tap < 4; tap++) {
+					const int32_t px = x0 + (tap & 1), py = y0 + (tap >> 1);
+					if (px < 0 || py < 0 || px >= (int32_t)width || py >= (int32_t)height) {
+						continue;
 					}
-					Ray ray{
-						cam.GetPosition(),
-						rays[idx]
-					};
-					clr = glm::vec3{ 0.f };
-					if (flags_cache & RenderMode_Unshaded) {	// do this comparison outside the loop
-						clr = evaluateRayAlbedo(scene, ray);
+					const uint32_t q = py * width + px;
+					const HistoryHit& h = this->history_hits[q];
+					const uint32_t n = this->accumulated_pixel_frames[q];
+					if (!n || h.type != hit.type || (!miss && h.primitive != hit.primitive)) {
+						continue;
 					}
-					else {
-						if (flags_cache & RenderMode_Recursive_Samples) {
-							clr = recursivelySampleRay(scene, ray, this->properties.recursive_samples, this->properties.bounce_limit);
-						}
-						else {
-							for (size_t s = 0; s < this->properties.pixel_samples; s++) {
-								clr += evaluateRay(scene, ray, this->properties.bounce_limit);
-							}
-							clr /= this->properties.pixel_samples;
-						}
-						clr = glm::clamp(clr, 0.f, 1.f);
-						if (this->accumulated_frames == 1) {
-							this->accumulated_samples[idx] = clr;
-						}
-						else {
-							clr = (this->accumulated_samples[idx] += clr);
-							clr /= this->accumulated_frames;
-						}
+					if (!miss) {
+						const glm::vec3 d = prev.GetPosition() + prev.GetRayDirection(px, py) * h.depth - hit.normal.origin;	// from the new hit to the old one
+						if (std::abs(glm::dot(d, hit.normal.direction)) > h.depth * REPROJECT_PLANE_TOLERANCE ||
+							glm::length(d) > h.depth * REPROJECT_DISTANCE_TOLERANCE) { continue; }
 					}
-					this->buffer[idx] = vec2rgba(glm::sqrt(clr), 1.f);
+					const float w = ((tap & 1) ? f.x : 1.f - f.x) * ((tap >> 1) ? f.y : 1.f - f.y);
+					mean += this->accumulated_samples[q] * (w / n);
+					square += this->accumulated_squares[q] * (w / n);
+					frames += w * n;
+					weight += w;
 				}
 			}
+			uint32_t n = 0;
+			if (weight > 1e-3f) {
+				n = std::min(std::max((uint32_t)(frames / weight + 0.5f), 1U), cap);	// capping keeps the mean, but lets new samples catch up
+				this->reprojected_samples[idx] = mean * ((float)n / weight);
+				this->reprojected_squares[idx] = square * ((float)n / weight);
+			} else {	// disoccluded, off screen before, or on a different surface
+				this->reprojected_samples[idx] = this->reprojected_squares[idx] = glm::vec3{ 0.f };
+			}
+			this->reprojected_pixel_frames[idx] = n;
+		}
+	};
+	if (flags & RenderMode_Parallelize) {
+		this->pool.run(height, [&row, this](uint32_t y, uint32_t thread) { row(y, this->thread_stats[thread]); });
+	} else {
+		for (uint32_t y = 0; y < height; y++) {
+			row(y, this->thread_stats[0]);
+		}
+	}
+
+	std::swap(this->history_hits, this->reprojected_hits);
+	this->history_view = gen;
+	if (warp) {
+		std::swap(this->accumulated_samples, this->reprojected_samples);
+		std::swap(this->accumulated_squares, this->reprojected_squares);
+		std::swap(this->accumulated_pixel_frames, this->reprojected_pixel_frames);
+	}
+}
+
+void Renderer::updateResolution(const Camera::RayGenerator& gen, int32_t flags) {
+	const bool moving = !(this->motion_view == gen);
+	this->motion_view = gen;
+	if (!(flags & RenderMode_Dynamic_Resolution) || (flags & RenderMode_Unshaded)) {
+		this->stride = 1;
+	} else if (moving) {
+		const double target = std::max(this->properties.target_frame_ms, 1.f);
+		if (this->last_frame_ms > target && this->stride < RESOLUTION_STRIDE_MAX) {
+			this->stride *= 2;
+		} else if (this->last_frame_ms * 4. < target && this->stride > 1) {	// a finer stride traces 4x the pixels
+			this->stride /= 2;
+		}
+		this->still_frames = 0;
+	} else if (this->stride > 1) {
+		if (this->still_frames >= this->stride * this->stride) {	// every position has been traced since the view stopped
+			this->stride = 1;
+		} else {
+			this->still_frames++;
+		}
+	}
+	if (this->stride == 1) {
+		this->grid_x = this->grid_y = 0;
+		return;
+	}
+	/* Positions are visited in ordered dither (Bayer) order, so every pass lands in between the previous ones -- the 2 x 2
+	* case is a checkerboard after the first two. That's the phase's bits reversed, then split into y and x ^ y. */
+	const uint32_t bits = this->stride == 2 ? 1 : 2;
+	const uint32_t k = this->grid_phase++ & ((1U << (bits * 2)) - 1);
+	uint32_t r = 0, a = 0, y = 0;
+	for (uint32_t b = 0; b < bits * 2; b++) {
+		r |= ((k >> b) & 1) << (bits * 2 - 1 - b);
+	}
+	for (uint32_t b = 0; b < bits; b++) {
+		a |= ((r >> (b * 2)) & 1) << b;
+		y |= ((r >> (b * 2 + 1)) & 1) << b;
+	}
+	this->grid_x = a ^ y;
+	this->grid_y = y;
+
+	if (this->accumulated_frames == 1) {	// the pixels that aren't traced must not keep anything from before the reset
+		std::fill(this->accumulated_samples.begin(), this->accumulated_samples.end(), glm::vec3{ 0.f });
+		std::fill(this->accumulated_squares.begin(), this->accumulated_squares.end(), glm::vec3{ 0.f });
+		std::fill(this->accumulated_pixel_frames.begin(), this->accumulated_pixel_frames.end(), 0U);
+	}
+}
+void Renderer::fillUntraced() {
+	const uint32_t width = this->width, height = this->height, mask = this->stride - 1;
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			if (this->onGrid(x, y)) {
+				continue;
+			}
+			const uint32_t idx = y * width + x, n = this->accumulated_pixel_frames[idx];
+			if (n) {
+				this->buffer[idx] = vec2rgba(glm::sqrt(this->accumulated_samples[idx] / (float)n), 1.f);
+				continue;
+			}
+			uint32_t
+				tx = (x & ~mask) + this->grid_x,	// the block's traced pixel, or the one before it along the edges
+				ty = (y & ~mask) + this->grid_y;
+			if (tx >= width) { tx = tx >= this->stride ? tx - this->stride : 0; }
+			if (ty >= height) { ty = ty >= this->stride ? ty - this->stride : 0; }
+			this->buffer[idx] = this->buffer[ty * width + tx];
+		}
+	}
+}
+
+void Renderer::renderPass(const Scene& scene, const Camera::RayGenerator& gen, int32_t flags, uint64_t frame_start) {
+	if ((flags & RenderMode_Wavefront) && (~flags & RenderMode_Unshaded)) {
+		this->renderWavefront(scene, gen, flags);
+	} else if (flags & RenderMode_Packets) {
+		const uint32_t tiles =
+			((this->width + PACKET_TILE - 1) / PACKET_TILE) *
+			((this->height + PACKET_TILE - 1) / PACKET_TILE);
+		this->runTiles(tiles, flags,
+			[&scene, &gen, flags, this](uint32_t tile, ThreadStats& stats) {
+				this->renderTile(scene, gen, tile, flags, stats);
+			}
+		);
+	} else if (flags & (RenderMode_Parallelize | RenderMode_Time_Budget)) {	// budgeted frames need tiles to resume from, even serially
+		const uint32_t
+			ts = (uint32_t)std::max(this->properties.tile_size, 1),	// cached, the gui may change it mid-frame
+			tiles = ((this->width + ts - 1) / ts) * ((this->height + ts - 1) / ts);
+		this->runTiles(tiles, flags,
+			[&scene, &gen, ts, flags, this](uint32_t tile, ThreadStats& stats) {
+				this->renderBlock(scene, gen, tile, ts, flags, stats);
+			}
 		);
 	} else {
-		uint32_t sz = this->image->GetWidth() * this->image->GetHeight();
+		ThreadStats& stats = this->thread_stats[0];
+		uint32_t sz = this->width * this->height;
 		for (uint32_t n = 0; n < sz; n++) {
 			if (this->render_interrupt) {
 				break;
 			}
+			if (this->skipped(n, flags)) {
+				continue;
+			}
+			stats.pixels++;
+			Rng rng = this->pixelRng(n, 0, flags);
 			Ray ray{
-				cam.GetPosition(),
-				rays[n]
+				gen.GetPosition(),
+				gen.GetRayDirection(n % this->width, n / this->width, pixelJitter(flags, rng))
 			};
+			Hit hit;
+			this->primaryHit(scene, ray, n, hit, stats);	// every sample starts from the same camera ray
 			glm::vec3 clr{ 0.f };
-			if (flags_cache & RenderMode_Unshaded) {	// do this comparison outside the loop
-				clr = evaluateRayAlbedo(scene, ray);
+			if (flags & RenderMode_Unshaded) {	// do this comparison outside the loop
+				clr = hit.type != Primitive_Count ? scene.surfaceAlbedo(hit) : scene.albedo(hit);
 			} else {
-				if (flags_cache & RenderMode_Recursive_Samples) {	// and this comparison
+				if (flags & RenderMode_Recursive_Samples) {	// and this comparison
 					for (size_t s = 0; s < this->properties.pixel_samples; s++) {
-						clr += recursivelySampleRay(scene, ray, this->properties.pixel_samples, this->properties.bounce_limit);
+						rng.seek((uint32_t)s, Rng::CAMERA_DIMENSIONS);
+						Hit h = hit;
+						clr += recursivelySampleHit(scene, ray, h, rng, stats, this->properties.pixel_samples, this->properties.bounce_limit);
 					}
 				} else {
 					for (size_t s = 0; s < this->properties.pixel_samples; s++) {
-						clr += evaluateRay(scene, ray, this->properties.bounce_limit);
+						rng.seek((uint32_t)s, Rng::CAMERA_DIMENSIONS);
+						clr += evaluateHit(scene, ray, hit, rng, stats, this->properties.bounce_limit, this->properties.roulette_depth);
 					}
 				}
 				clr /= this->properties.pixel_samples;
 				clr = glm::clamp(clr, 0.f, 1.f);
-				if (this->accumulated_frames == 1) {
-					this->accumulated_samples[n] = clr;
-				} else {
-					clr = (this->accumulated_samples[n] += clr);
-					clr /= this->accumulated_frames;
-				}
+				clr = this->accumulate(n, clr);
 			}
 			this->buffer[n] = vec2rgba(glm::sqrt(clr), 1.f);
 		}
+		stats.busy_ns = nanoseconds() - frame_start;
+	}
+}
+void Renderer::runTiles(uint32_t tiles, int32_t flags, const std::function<void(uint32_t, ThreadStats&)>& f) {
+	const bool budget = flags & RenderMode_Time_Budget;
+	if (budget) {	// a pass that was cut off is finished first, so that no part of the image falls behind
+		if (this->tile_passes.size() != tiles) {
+			this->tile_passes.assign(tiles, 0U);
+			this->tile_order.resize(tiles);
+			std::iota(this->tile_order.begin(), this->tile_order.end(), 0U);
+		}
+		std::stable_sort(this->tile_order.begin(), this->tile_order.end(),
+			[this](uint32_t a, uint32_t b) { return this->tile_passes[a] < this->tile_passes[b]; });
+	}
+	auto task = [budget, &f, this](uint32_t t, uint32_t thread) {
+		if (this->preempted()) {
+			return;
+		}
+		const uint32_t tile = budget ? this->tile_order[t] : t;
+		ThreadStats& stats = this->thread_stats[thread];
+		const uint64_t start = nanoseconds();
+		f(tile, stats);
+		stats.busy_ns += nanoseconds() - start;
+		if (budget && !this->render_interrupt) {
+			this->tile_passes[tile]++;
+		}
+	};
+	if (flags & RenderMode_Parallelize) {
+		this->pool.run(tiles, task);
+	} else {
+		for (uint32_t t = 0; t < tiles; t++) {
+			task(t, 0);
+		}
+	}
+}
+bool Renderer::preempted() const {
+	return this->render_interrupt || (this->deadline_ns && nanoseconds() >= this->deadline_ns);
+}
+
+void Renderer::render(const Scene& scene, const Camera& cam) {
+
+	this->render_interrupt = false;
+	int32_t flags_cache = this->properties.render_flags;
+	this->frame_count++;
+	const Camera::RayGenerator gen = cam.GetRayGenerator();
+
+	if (flags_cache & RenderMode_Parallelize) {
+		this->pool.resize((uint32_t)std::max(this->properties.cpu_threads, 1), flags_cache & RenderMode_Pin_Threads);
+	}
+	ThreadStats stats_init;
+	stats_init.bounce_limit = (size_t)std::max(this->properties.bounce_limit, 0);
+	this->thread_stats.assign((flags_cache & RenderMode_Parallelize) ? this->pool.size() : 1, stats_init);
+	const uint64_t frame_start = nanoseconds();
+	this->primary_cache = this->updatePrimaryCache(scene, gen, flags_cache);
+	if ((flags_cache & RenderMode_Reproject) && (flags_cache & RenderMode_Accumulate) && (~flags_cache & RenderMode_Unshaded)) {
+		this->reproject(scene, gen, flags_cache);
+	} else {
+		this->history_stale = true;		// the depths wouldn't follow the view
+	}
+	this->updateResolution(gen, flags_cache);
+
+	/* Time budgeted frames keep starting passes until the target frame time is up, and the deadline cuts off whichever one
+	* runs into it. The first pass after a reset always completes, since nothing could fill in the pixels that it leaves out. */
+	const bool budgeted =
+		(flags_cache & RenderMode_Time_Budget) && (flags_cache & RenderMode_Accumulate) &&
+		(~flags_cache & RenderMode_Unshaded) && this->stride == 1;
+	const uint64_t budget_end = frame_start + (uint64_t)(std::max(this->properties.target_frame_ms, 1.f) * 1e6);
+	this->deadline_ns = budgeted && this->accumulated_frames > 1 ? budget_end : 0;
+	uint32_t passes = 0;
+	double pass_ms = 0.;
+	for (;;) {
+		this->renderPass(scene, gen, flags_cache, frame_start);
+		const uint64_t now = nanoseconds();
+		if (!passes++) {
+			pass_ms = (now - frame_start) * 1e-6;
+		}
+		if (!budgeted || this->render_interrupt || now >= budget_end) {
+			break;
+		}
+		this->accumulated_frames++;
+		this->frame_count++;	// new samples for the next pass
+		this->deadline_ns = budget_end;
+	}
+	this->deadline_ns = 0;
+	if (this->stride > 1 && !this->render_interrupt) {
+		this->fillUntraced();
+	}
+	if (!this->render_interrupt) {
+		this->last_frame_ms = pass_ms;		// dynamic resolution follows the cost of a pass, not of the budget
+		this->mergeStats((nanoseconds() - frame_start) * 1e-6, passes);
 	}
-	this->buffer_write_lock.unlock();
 	if ((flags_cache & RenderMode_Accumulate) && (~flags_cache & RenderMode_Unshaded) && !this->render_interrupt) {
 		this->accumulated_frames++;
 	}
-	if ((flags_cache & RenderMode_Sync_Frame) && !this->render_interrupt) {
-		this->buffer_read_lock.lock();
-		this->frame_lock.lock();
-
-		this->image->SetData(this->buffer);
-		
-		this->buffer_read_lock.unlock();
-		this->frame_lock.unlock();
+	if ((~flags_cache & RenderMode_Sync_Frame) || !this->render_interrupt) {	// unsynced output also shows frames that were cut short
+		this->publishOutput();
 	}
 
 	/*if (flags_cache & RenderMode_Sync_Frame) {
@@ -245,51 +771,483 @@ void Renderer::render(const Scene& scene, const Camera& cam) {
 	}*/
 
 }
+void Renderer::mergeStats(double frame_ms, uint32_t passes) {
+	FrameStats f;
+	f.frame = this->frame_count;
+	f.passes = passes;
+	f.bounce_limit = (uint32_t)std::max(this->properties.bounce_limit, 0);
+	f.frame_ms = frame_ms;
+	f.busy_ms.reserve(this->thread_stats.size());
+	uint64_t intersect_ns = 0, busy_ns = 0;
+	for (const ThreadStats& t : this->thread_stats) {
+		f.trace += t.trace;
+		for (uint32_t d = 0; d < STATS_DEPTHS; d++) {
+			f.depth_rays[d] += t.depth_rays[d];
+		}
+		f.luminance_exits += t.luminance_exits;
+		f.shadow_rays += t.shadow_rays;
+		f.roulette_exits += t.roulette_exits;
+		f.cached_hits += t.cached_hits;
+		f.pixels += t.pixels;
+		intersect_ns += t.intersect_ns;
+		busy_ns += t.busy_ns;
+		f.busy_ms.push_back(t.busy_ns * 1e-6);
+	}
+	f.intersect_ms = intersect_ns * 1e-6;
+	f.shade_ms = (busy_ns > intersect_ns ? busy_ns - intersect_ns : 0) * 1e-6;
+
+	std::scoped_lock l(this->stats_lock);
+	if (this->stats_history.size() >= STATS_HISTORY) {
+		this->stats_history.pop_front();
+	}
+	this->stats_history.push_back(std::move(f));
+}
+
+bool Renderer::converged(uint32_t idx, int32_t flags) const {
+	if (!(flags & RenderMode_Adaptive) || (flags & RenderMode_Unshaded) || this->accumulated_frames == 1) {
+		return false;
+	}
+	const uint32_t n = this->accumulated_pixel_frames[idx];
+	if (n < (uint32_t)std::max(this->properties.adaptive_min_frames, 2)) {
+		return false;
+	}
+	const glm::vec3
+		mean = this->accumulated_samples[idx] / (float)n,
+		variance = glm::max(this->accumulated_squares[idx] / (float)n - mean * mean, glm::vec3{ 0.f });
+	/* Standard error of the accumulated mean, carried through the sqrt() that the output goes through (d sqrt(x) =
+	* dx / 2 sqrt(x)) so that dark pixels aren't held to a tighter absolute bound than what is visible. */
+	const glm::vec3 error = glm::sqrt(variance / (float)(n - 1)) / (2.f * glm::sqrt(mean) + 1e-2f);
+	return glm::max(error.r, glm::max(error.g, error.b)) < this->properties.adaptive_threshold;
+}
+Rng Renderer::pixelRng(uint32_t idx, uint32_t sample, int32_t flags) const {
+	const uint32_t seed = (uint32_t)this->properties.seed;
+	Rng rng{ seed, idx, this->frame_count, sample };
+	const auto seq = (Rng::Sequence)this->properties.sampler;	// negative values wrap past Sequence_Count
+	if (seq > Rng::Sequence_Random && seq < Rng::Sequence_Count) {
+		/* Sequences are indexed by the pixel's own sample count, so that an accumulation (or a pixel that adaptive
+		* sampling skipped for a while) always continues with the next points instead of wherever the frame count is. */
+		const uint32_t
+			samples = (uint32_t)std::max(this->properties.pixel_samples, 1),
+			frame = !(flags & RenderMode_Accumulate) ? this->frame_count :
+				this->accumulated_frames == 1 ? 0 : this->accumulated_pixel_frames[idx];
+		rng.sequence(seq, seed, idx % this->width, idx / this->width, frame * samples + sample);
+	}
+	return rng;
+}
+glm::vec3 Renderer::accumulate(uint32_t idx, glm::vec3 clr) {
+	if (this->accumulated_frames == 1) {
+		this->accumulated_samples[idx] = clr;
+		this->accumulated_squares[idx] = clr * clr;
+		this->accumulated_pixel_frames[idx] = 1;
+		return clr;
+	}
+	this->accumulated_squares[idx] += clr * clr;
+	return (this->accumulated_samples[idx] += clr) / (float)(++this->accumulated_pixel_frames[idx]);
+}
+
+void Renderer::renderBlock(const Scene& scene, const Camera::RayGenerator& gen, uint32_t tile, uint32_t ts, int32_t flags, ThreadStats& stats) {
+	const uint32_t
+		width = this->width,
+		height = this->height,
+		tiles_x = (width + ts - 1) / ts,
+		x0 = (tile % tiles_x) * ts,
+		y0 = (tile / tiles_x) * ts,
+		x1 = std::min(x0 + ts, width),
+		y1 = std::min(y0 + ts, height);
+	glm::vec3 clr;
+	for (uint32_t y = y0; y < y1; y++) {
+		for (uint32_t x = x0; x < x1; x++) {	// for each pixel in the tile...
+			if (this->render_interrupt) {
+				return;
+			}
+			const uint32_t idx = y * width + x;
+			if (this->skipped(idx, flags)) {
+				continue;
+			}
+			stats.pixels++;
+			Rng rng = this->pixelRng(idx, 0, flags);
+			Ray ray{
+				gen.GetPosition(),
+				gen.GetRayDirection(x, y, pixelJitter(flags, rng))
+			};
+			Hit hit;
+			this->primaryHit(scene, ray, idx, hit, stats);	// every sample starts from the same camera ray
+			clr = glm::vec3{ 0.f };
+			if (flags & RenderMode_Unshaded) {	// do this comparison outside the loop
+				clr = hit.type != Primitive_Count ? scene.surfaceAlbedo(hit) : scene.albedo(hit);
+			}
+			else {
+				if (flags & RenderMode_Recursive_Samples) {
+					clr = recursivelySampleHit(scene, ray, hit, rng, stats, this->properties.recursive_samples, this->properties.bounce_limit);
+				}
+				else {
+					for (size_t s = 0; s < this->properties.pixel_samples; s++) {
+						rng.seek((uint32_t)s, Rng::CAMERA_DIMENSIONS);
+						clr += evaluateHit(scene, ray, hit, rng, stats, this->properties.bounce_limit, this->properties.roulette_depth);
+					}
+					clr /= this->properties.pixel_samples;
+				}
+				clr = glm::clamp(clr, 0.f, 1.f);
+				clr = this->accumulate(idx, clr);
+			}
+			this->buffer[idx] = vec2rgba(glm::sqrt(clr), 1.f);
+		}
+	}
+}
+void Renderer::renderTile(const Scene& scene, const Camera::RayGenerator& gen, uint32_t tile, int32_t flags, ThreadStats& stats) {
+	if (this->render_interrupt) {
+		return;
+	}
+	const uint32_t
+		width = this->width,
+		height = this->height,
+		tiles_x = (width + PACKET_TILE - 1) / PACKET_TILE,
+		x0 = (tile % tiles_x) * PACKET_TILE,
+		y0 = (tile / tiles_x) * PACKET_TILE,
+		x1 = std::min(x0 + PACKET_TILE, width),
+		y1 = std::min(y0 + PACKET_TILE, height);
+
+	Ray packet[PACKET_TILE * PACKET_TILE];
+	Hit hits[PACKET_TILE * PACKET_TILE];
+	Rng rngs[PACKET_TILE * PACKET_TILE];
+	uint32_t pixels[PACKET_TILE * PACKET_TILE];
+	uint32_t n = 0;
+	for (uint32_t y = y0; y < y1; y++) {
+		for (uint32_t x = x0; x < x1; x++) {
+			const uint32_t idx = y * width + x;
+			if (this->skipped(idx, flags)) {	// only the remaining pixels make up the packet
+				continue;
+			}
+			pixels[n] = idx;
+			rngs[n] = this->pixelRng(idx, 0, flags);
+			packet[n] = Ray{ gen.GetPosition(), gen.GetRayDirection(x, y, pixelJitter(flags, rngs[n])) };
+			n++;
+		}
+	}
+	if (!n) {
+		return;
+	}
+	stats.pixels += n;
+	uint32_t cached = 0;
+	if (this->primary_cache) {
+		for (uint32_t i = 0; i < n; i++) {
+			cached += this->primaryCached(pixels[i]);
+		}
+	}
+	if (cached == n) {	// the whole packet was traced before
+		for (uint32_t i = 0; i < n; i++) {
+			hits[i] = this->primary_hits[pixels[i]];
+		}
+		stats.cached_hits += n;
+	} else {
+		const uint64_t start = nanoseconds();
+		scene.intersectPacket(packet, hits, n, 1e-5f, std::numeric_limits<float>::infinity(), &stats.trace);
+		stats.intersect_ns += nanoseconds() - start;
+		stats.traced(stats.bounce_limit, n);
+		if (this->primary_cache) {
+			for (uint32_t i = 0; i < n; i++) {
+				this->primary_hits[pixels[i]] = hits[i];
+				this->primary_frames[pixels[i]] = this->frame_count + 1;
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		const uint32_t idx = pixels[i];
+		Rng& rng = rngs[i];
+		glm::vec3 clr{ 0.f };
+		if (flags & RenderMode_Unshaded) {
+			clr = hits[i].type != Primitive_Count ? scene.surfaceAlbedo(hits[i]) : scene.albedo(hits[i]);
+		} else {
+			if (flags & RenderMode_Recursive_Samples) {
+				clr = recursivelySampleHit(scene, packet[i], hits[i], rng, stats, this->properties.recursive_samples, this->properties.bounce_limit);
+			} else {
+				for (size_t s = 0; s < this->properties.pixel_samples; s++) {	// the primary hit is shared by every sample
+					rng.seek((uint32_t)s, Rng::CAMERA_DIMENSIONS);
+					clr += evaluateHit(scene, packet[i], hits[i], rng, stats, this->properties.bounce_limit, this->properties.roulette_depth);
+				}
+				clr /= this->properties.pixel_samples;
+			}
+			clr = glm::clamp(clr, 0.f, 1.f);
+			clr = this->accumulate(idx, clr);
+		}
+		this->buffer[idx] = vec2rgba(glm::sqrt(clr), 1.f);
+	}
+}
 
-glm::vec3 Renderer::evaluateRayAlbedo(const Scene& s, const Ray& r) {
+/* Same result as evaluateRay() for every sample, but instead of following one path to completion at a time, each bounce
+* is run as a stage over every path in flight: extend (intersect all active rays), sort (group the hits by material),
+* shade (evaluate each surface and write the redirected ray back into the path), and compact (drop finished paths). */
+void Renderer::renderWavefront(const Scene& scene, const Camera::RayGenerator& gen, int32_t flags) {
+	auto& wf = this->wavefront;
+	auto each = [flags, this](uint32_t n, auto&& f) {	// f(i, stats) for every i in [0, n)
+		if (flags & RenderMode_Parallelize) {
+			this->pool.run((n + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK, [n, &f, this](uint32_t c, uint32_t thread) {
+				ThreadStats& stats = this->thread_stats[thread];
+				const uint64_t start = nanoseconds();
+				for (uint32_t i = c * WAVEFRONT_CHUNK; i < std::min((c + 1) * WAVEFRONT_CHUNK, n); i++) { f(i, stats); }
+				stats.busy_ns += nanoseconds() - start;
+			});
+		} else {
+			ThreadStats& stats = this->thread_stats[0];
+			const uint64_t start = nanoseconds();
+			for (uint32_t i = 0; i < n; i++) { f(i, stats); }
+			stats.busy_ns += nanoseconds() - start;
+		}
+	};
+	ThreadStats& caller = this->thread_stats.back();	// runs the serial stages
+	const uint32_t
+		width = this->width,
+		pixels = width * this->height,
+		samples = (uint32_t)std::max(this->properties.pixel_samples, 1),
+		materials = scene.getPrimitives().materialCount();
+	const int32_t
+		bounce_limit = this->properties.bounce_limit,	// cached, the gui may change them mid-frame
+		roulette_depth = this->properties.roulette_depth;
+	uint32_t batch = std::max(WAVEFRONT_BATCH / samples, 1U);	// pixels per pass
+	if (flags & RenderMode_Time_Budget) {
+		batch = std::max(std::min(batch, (pixels + WAVEFRONT_BUDGET_BATCHES - 1) / WAVEFRONT_BUDGET_BATCHES), 1U);
+	}
+
+	/* Time budgeted passes start at the batch that the last one stopped before, so a pass that gets cut off is continued
+	* instead of going over the same pixels again. */
+	const uint32_t
+		batches = (pixels + batch - 1) / batch,
+		first = (flags & RenderMode_Time_Budget) && batches ? this->wavefront_resume % batches : 0;
+	uint32_t done = 0;
+	for (; done < batches && !this->preempted(); done++) {
+		const uint32_t
+			p0 = ((first + done) % batches) * batch,
+			p1 = std::min(p0 + batch, pixels),
+			n = (p1 - p0) * samples;
+		wf.paths.resize(n);
+		wf.hits.resize(n);
+		wf.queue.resize(n);
+		wf.sorted.resize(n);
+		wf.keys.resize(n);
+
+		// generate
+		each(n, [&](uint32_t i, ThreadStats& stats) {
+			const uint32_t pixel = p0 + i / samples;
+			PathState& path = wf.paths[i];
+			path = PathState{};
+			wf.queue[i] = i;
+			if (this->skipped(pixel, flags)) {
+				path.alive = false;
+				return;
+			}
+			stats.pixels += (i % samples == 0);
+			path.rng = this->pixelRng(pixel, i % samples, flags);
+			path.ray = Ray{ gen.GetPosition(), gen.GetRayDirection(pixel % width, pixel / width, pixelJitter(flags, path.rng)) };
+		});
+		uint32_t active = n;
+		if ((flags & RenderMode_Adaptive) || this->stride > 1) {	// drop the paths of skipped pixels before the first extend
+			const uint64_t start = nanoseconds();
+			active = (uint32_t)(std::remove_if(wf.queue.begin(), wf.queue.begin() + active,
+				[&wf](uint32_t p) { return !wf.paths[p].alive; }) - wf.queue.begin());
+			caller.busy_ns += nanoseconds() - start;
+		}
+		if (this->primary_cache && active > 0) {	// one lookup per pixel, shared by its paths -- without jitter they all start on the same ray
+			each(p1 - p0, [&](uint32_t i, ThreadStats& stats) {
+				const uint32_t first = i * samples;
+				if (!wf.paths[first].alive) {
+					return;
+				}
+				this->primaryHit(scene, wf.paths[first].ray, p0 + i, wf.hits[first], stats);
+				std::fill(wf.hits.begin() + first + 1, wf.hits.begin() + first + samples, wf.hits[first]);
+			});
+		}
+		for (int32_t b = bounce_limit; active > 0 && !this->render_interrupt; b--) {
+			// extend
+			each(active, [&](uint32_t i, ThreadStats& stats) {
+				const uint32_t p = wf.queue[i];
+				Hit& hit = wf.hits[p];
+				if (b != bounce_limit || !this->primary_cache) {	// cached camera hits were looked up above
+					hit = Hit{};
+					traceRay(scene, wf.paths[p].ray, hit, stats, (size_t)b);
+				}
+				wf.keys[p] = hit.type != Primitive_Count ? hit.material : 0;	// misses share the null material's bucket
+			});
+			// sort -- counting sort, there are only ever a handful of materials
+			uint64_t start = nanoseconds();
+			wf.offsets.assign(materials + 1, 0);
+			for (uint32_t i = 0; i < active; i++) {
+				wf.offsets[wf.keys[wf.queue[i]] + 1]++;
+			}
+			for (uint32_t m = 1; m <= materials; m++) {
+				wf.offsets[m] += wf.offsets[m - 1];
+			}
+			for (uint32_t i = 0; i < active; i++) {
+				const uint32_t p = wf.queue[i];
+				wf.sorted[wf.offsets[wf.keys[p]]++] = p;
+			}
+			caller.busy_ns += nanoseconds() - start;
+			// shade
+			each(active, [&](uint32_t i, ThreadStats& stats) {
+				const uint32_t p = wf.sorted[i];
+				PathState& path = wf.paths[p];
+				Hit& hit = wf.hits[p];
+				if (hit.type == Primitive_Count) {
+					path.radiance += path.throughput * scene.albedo(hit);
+					path.alive = false;
+					return;
+				}
+				const float
+					lum = hit.luminance,
+					emit = lum > 0.f ? lum * emissionWeight(scene, path.ray, hit, path.pdf) : 0.f;
+				const glm::vec3 clr = scene.surfaceAlbedo(hit);
+				const bool emitter = ((clr.r + clr.g + clr.b) / 3.f * lum) >= 1.f;
+				if (b <= 0 || emitter) {
+					stats.luminance_exits += (b > 0 && emitter);
+					path.radiance += path.throughput * clr * emit;
+					path.alive = false;
+					return;
+				}
+				Ray redirect;
+				Lobe lobe;
+				if (scene.surfaceRedirect(path.ray, hit, redirect, path.rng, lobe)) {
+					const bool diffuse = lobe.type == Lobe_Diffuse;
+					const glm::vec3 direct = diffuse ? sampleDirect(scene, path.ray, hit, path.rng, stats) : glm::vec3{ 0.f };
+					path.radiance += path.throughput * clr * (emit + direct);
+					path.throughput *= clr;
+					path.pdf = diffuse ? lobe.pdf : 0.f;
+					path.ray = redirect;
+					if (bounce_limit - b >= roulette_depth && !survive(path.throughput, path.rng, stats)) {
+						path.alive = false;
+					}
+				} else {
+					path.radiance += path.throughput * scene.albedo(hit);
+					path.alive = false;
+				}
+			});
+			// compact
+			start = nanoseconds();
+			active = (uint32_t)(std::remove_if(wf.sorted.begin(), wf.sorted.begin() + active,
+				[&wf](uint32_t p) { return !wf.paths[p].alive; }) - wf.sorted.begin());
+			std::swap(wf.queue, wf.sorted);
+			caller.busy_ns += nanoseconds() - start;
+		}
+		if (this->render_interrupt) {
+			return;
+		}
+
+		// resolve
+		each(p1 - p0, [&](uint32_t i, ThreadStats&) {
+			const uint32_t idx = p0 + i;
+			if (this->skipped(idx, flags)) {
+				return;
+			}
+			glm::vec3 clr{ 0.f };
+			for (uint32_t s = 0; s < samples; s++) {
+				clr += wf.paths[i * samples + s].radiance;
+			}
+			clr = glm::clamp(clr / (float)samples, 0.f, 1.f);
+			clr = this->accumulate(idx, clr);
+			this->buffer[idx] = vec2rgba(glm::sqrt(clr), 1.f);
+		});
+	}
+	this->wavefront_resume = batches ? (first + done) % batches : 0;
+}
+
+glm::vec3 Renderer::evaluateRayAlbedo(const Scene& s, const Ray& r, ThreadStats& stats) {
 	Hit h;
-	if (const Interactable* o = s.interacts(r, h)) {
-		return o->albedo(h);
+	if (traceRay(s, r, h, stats, stats.bounce_limit)) {
+		return s.surfaceAlbedo(h);
 	}
 	return s.albedo(h);
 }
-glm::vec3 Renderer::evaluateRay(const Scene& s, const Ray& r, size_t b) {
+glm::vec3 Renderer::evaluateRay(const Scene& s, const Ray& r, Rng& rng, ThreadStats& stats, size_t b, size_t roulette) {
 	Hit hit;
-	if (const Interactable* obj = s.interacts(r, hit)) {
-		float lum = obj->emmission(hit);
-		glm::vec3 clr = obj->albedo(hit);
-		if (b == 0 || ((clr.r + clr.g + clr.b) / 3.f * lum) >= 1.f) {
-			return clr * lum;
+	traceRay(s, r, hit, stats, b);
+	return evaluateHit(s, r, hit, rng, stats, b, roulette);
+}
+glm::vec3 Renderer::evaluateHit(const Scene& s, const Ray& r, const Hit& first, Rng& rng, ThreadStats& stats, size_t b, size_t roulette) {
+	glm::vec3
+		radiance{ 0.f },
+		throughput{ 1.f };	// product of the albedos so far (divided by the survival probabilities)
+	Ray ray = r;
+	Hit hit = first;	// packets share the primary hit across samples
+	float pdf = 0.f;
+	for (size_t depth = 0;; depth++) {
+		if (hit.type == Primitive_Count) {
+			return radiance + throughput * s.albedo(hit);
+		}
+		const float
+			lum = hit.luminance,
+			emit = lum > 0.f ? lum * emissionWeight(s, ray, hit, pdf) : 0.f;
+		const glm::vec3 clr = s.surfaceAlbedo(hit);
+		if (b == 0 || luminanceExit(clr, lum, stats)) {
+			return radiance + throughput * clr * emit;
 		}
 		Ray redirect;
-		if (obj->redirect(r, hit, redirect)) {
-			return clr * (evaluateRay(s, redirect, b - 1) + lum);
+		Lobe lobe;
+		if (!s.surfaceRedirect(ray, hit, redirect, rng, lobe)) {
+			return radiance + throughput * s.albedo(hit);
+		}
+		const bool diffuse = lobe.type == Lobe_Diffuse;
+		const glm::vec3 direct = diffuse ? sampleDirect(s, ray, hit, rng, stats) : glm::vec3{ 0.f };
+		radiance += throughput * clr * (emit + direct);
+		throughput *= clr;
+		pdf = diffuse ? lobe.pdf : 0.f;
+		if (depth >= roulette && !survive(throughput, rng, stats)) {
+			return radiance;
 		}
+		ray = redirect;
+		hit = Hit{};
+		traceRay(s, ray, hit, stats, --b);
 	}
-	return s.albedo(hit);
 }
-glm::vec3 Renderer::recursivelySampleRay(const Scene& scene, const Ray& ray, size_t samples, size_t b) {
+glm::vec3 Renderer::recursivelySampleRay(const Scene& scene, const Ray& ray, Rng& rng, ThreadStats& stats, size_t samples, size_t b, float pdf) {
 	Hit hit;
-	if (const Interactable* obj = scene.interacts(ray, hit)) {
-		float lum = obj->emmission(hit);
-		glm::vec3 clr = obj->albedo(hit);
-		if (b == 0 || ((clr.r + clr.g + clr.b) / 3.f * lum) >= 1.f) {
-			return clr * lum;
+	traceRay(scene, ray, hit, stats, b);
+	return recursivelySampleHit(scene, ray, hit, rng, stats, samples, b, pdf);
+}
+glm::vec3 Renderer::recursivelySampleHit(const Scene& scene, const Ray& ray, Hit& hit, Rng& rng, ThreadStats& stats, size_t samples, size_t b, float pdf) {
+	if (hit.type != Primitive_Count) {
+		float lum = hit.luminance;
+		glm::vec3 clr = scene.surfaceAlbedo(hit);
+		const float emit = lum > 0.f ? lum * emissionWeight(scene, ray, hit, pdf) : 0.f;
+		if (b == 0 || luminanceExit(clr, lum, stats)) {
+			return clr * emit;
 		}
 		Ray redirect;
+		Lobe lobe;
 		glm::vec3 sum;
 		for (size_t s = 0; s < samples; s++) {
-			if (!obj->redirect(ray, hit, redirect)) {
+			if (!scene.surfaceRedirect(ray, hit, redirect, rng, lobe)) {
 				if (!s) {
 					return scene.albedo(hit);
 				}
 				samples = s;
 				break;
 			}
-			sum += recursivelySampleRay(scene, redirect, samples, b - 1);
+			if (lobe.type == Lobe_Diffuse) {
+				sum += sampleDirect(scene, ray, hit, rng, stats);
+				sum += recursivelySampleRay(scene, redirect, rng, stats, samples, b - 1, lobe.pdf);
+			} else {
+				sum += recursivelySampleRay(scene, redirect, rng, stats, samples, b - 1);
+			}
 		}
 		sum /= samples;
-		return clr * (sum + lum);
+		return clr * (sum + emit);
 	}
 	return scene.albedo(hit);
+}
+glm::vec3 Renderer::sampleDirect(const Scene& s, const Ray& r, Hit& hit, Rng& rng, ThreadStats& stats) {
+	PrimitiveStore::LightSample light;
+	if (!s.sampleLight(hit.normal.origin, rng, light)) {
+		return glm::vec3{ 0.f };
+	}
+	const float bsdf_pdf = s.surfacePdf(r, hit, light.direction, Lobe_Diffuse);
+	if (bsdf_pdf <= 0.f) {
+		return glm::vec3{ 0.f };	// behind the surface
+	}
+	Hit l;
+	stats.shadow_rays++;
+	if (!timedIntersect(s, Ray{ hit.normal.origin, light.direction }, l, stats) || l.type != light.type || l.primitive != light.primitive) {
+		return glm::vec3{ 0.f };	// occluded
+	}
+	/* BSDF * cos (= albedo * bsdf_pdf for the diffuse lobe) / light_pdf, times the power heuristic weight light_pdf^2 /
+	* (light_pdf^2 + bsdf_pdf^2) -- the albedo is applied by the caller like for any other bounce. */
+	return s.surfaceAlbedo(l) * l.luminance * (bsdf_pdf * light.pdf / (light.pdf * light.pdf + bsdf_pdf * bsdf_pdf));
 }
\ No newline at end of file
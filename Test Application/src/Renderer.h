@@ -3,17 +3,21 @@
 #include <memory>
 #include <array>
 #include <vector>
+#include <deque>
+#include <algorithm>
+#include <limits>
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <functional>
+#include <future>
 //#include <shared_mutex>
 
 #include <glm/glm.hpp>
 
-#include "Walnut/Image.h"
-
 #include "Camera.h"
 #include "Scene.h"
+#include "ThreadPool.h"
 
 
 class Renderer {
@@ -22,16 +26,37 @@ public:
 	Renderer() = default;
 	Renderer(const Properties& p) : properties(p) {}
 
-	bool resize(uint32_t, uint32_t);
+	bool resize(uint32_t, uint32_t);	// resize() and render() must be called from the same thread
 	void render(const Scene&, const Camera&);
 
-	std::shared_ptr<Walnut::Image> getOutput() const;
-	//std::shared_ptr<Walnut::Image> getImmediateOutput() const;
+	/* Passes the latest published frame (packed RGBA8, bottom row first) to 'f' without blocking -- only completed frames
+	* are published when synced, otherwise interrupted ones are too. Must only be called from one thread at a time. */
+	void readOutput(const std::function<void(const uint32_t* rgba, uint32_t width, uint32_t height)>& f) const;
+	inline uint32_t getWidth() const { return this->width; }
+	inline uint32_t getHeight() const { return this->height; }
+
+	struct FrameStats;
+	// passes the profiled history (oldest first, interrupted frames are left out) to 'f' while it is locked
+	void readStats(const std::function<void(const std::deque<FrameStats>&)>& f) const;
+	bool writeStatsCSV(const char* path) const;
+
+	/* Checkpoints of the accumulation, so that a long render can pick up where it left off after a restart. Saving copies
+	* the accumulation and writes it out on a background thread (false if there is nothing accumulated or the last write
+	* is still going). Loading only succeeds if the size, scene, view and sampling settings match the ones that were
+	* saved, and restores the seed and sampler with it. Both must be called from the render thread, between frames. */
+	bool saveCheckpoint(const char* path, const Scene&, const Camera&);
+	bool loadCheckpoint(const char* path, const Scene&, const Camera&);
+	bool finishCheckpoint();	// waits for the last save to be written, returns if it was
+	inline uint32_t getAccumulatedFrames() const { return this->accumulated_frames - 1; }
 
+#ifndef RT_HEADLESS
 	bool invokeGuiOptions();
+#endif
 
 	inline void resetRender() {
 		this->render_interrupt = true;
+		this->primary_stale = true;	// the scene may have been edited
+		this->history_stale = true;
 		this->accumulated_frames = 1;
 	}
 	inline void resetAccumulation() {
@@ -39,7 +64,6 @@ public:
 	}
 
 	//inline void resetAccumulatedFrames() { this->accumulated_frames = 1; }
-	//inline void updateRandomRays(const Camera& c) { c.CalculateRandomDirections(this->aa_rays); }
 
 	enum {
 //		RenderMode_Raw = 0,
@@ -48,36 +72,213 @@ public:
 		RenderMode_AA_Random = 1 << 2,
 		RenderMode_Parallelize = 1 << 3,
 		RenderMode_Unshaded = 1 << 4,
-		RenderMode_Recursive_Samples = 1 << 5
+		RenderMode_Recursive_Samples = 1 << 5,
+		RenderMode_Packets = 1 << 6,		// trace primary rays as coherent tile packets and reuse the hit for every sample
+		RenderMode_Wavefront = 1 << 7,		// trace every path one bounce at a time through shared queues (takes precedence over the above)
+		RenderMode_Pin_Threads = 1 << 8,		// lock each render thread to its own core
+		RenderMode_Adaptive = 1 << 9,		// stop tracing accumulated pixels once their estimated error is below the threshold
+		RenderMode_Reproject = 1 << 10,		// warp the accumulation to follow camera motion instead of restarting it
+		RenderMode_Dynamic_Resolution = 1 << 11,		// trace fewer pixels while the camera moves to keep up with the target frame time
+		RenderMode_Time_Budget = 1 << 12		// keep accumulating passes until the target frame time is used up, cutting the last one short
 	};
+	static constexpr uint32_t
+		PACKET_TILE = 8,		// packets are PACKET_TILE x PACKET_TILE pixels
+		WAVEFRONT_BATCH = 1 << 18,		// max paths in flight per wavefront pass
+		WAVEFRONT_CHUNK = 1 << 10,		// paths per scheduled task within a wavefront stage
+		WAVEFRONT_BUDGET_BATCHES = 16,	// time budgeted wavefront passes are split into at least this many batches to stop between
+		STATS_DEPTHS = 32,		// bounce depths that get their own ray counter (deeper ones share the last)
+		STATS_HISTORY = 256,	// profiled frames that are kept around
+		STATS_TIMING_STRIDE = 16,	// only every n'th intersection is timed (and scaled up) -- reading the clock costs about as much as a cheap ray
+		RESOLUTION_STRIDE_MAX = 4;	// dynamic resolution traces at least one pixel in every 4 x 4 block
+	static constexpr float
+		REPROJECT_PLANE_TOLERANCE = 0.01f,	// how far an old hit may be off the new hit's surface, relative to its distance from the old camera
+		REPROJECT_DISTANCE_TOLERANCE = 0.1f;	// and how far it may be from the new hit at all
 	struct Properties {
 		int32_t
 			render_flags{ RenderMode_Accumulate },
 			bounce_limit{ 5U },
 			pixel_samples{ 5U },
 			aa_random_rays{ 3U },
-			recursive_samples{ 3U }/*,
-			cpu_threads{ std::thread::hardware_concurrency() * 0.75f }*/;
+			recursive_samples{ 3U },
+			cpu_threads{ (int32_t)ThreadPool::hardwareThreads() },
+			tile_size{ 16U },	// square tiles scheduled across the threads when parallelized
+			seed{ 0U },		// renders are reproducible for a given seed and sequence of frames
+			adaptive_min_frames{ 32U },	// accumulated frames before a pixel's variance estimate is trusted
+			roulette_depth{ 3U },	// bounces before paths may be terminated randomly (none when >= bounce_limit)
+			reproject_history{ 16U },	// most frames that a reprojected pixel keeps, so that it still adapts to its new view
+			sampler{ Rng::Sequence_Sobol };	// where camera jitter and bounce directions are drawn from
+		float adaptive_threshold{ 0.001f };	// standard error of a pixel's displayed (gamma corrected) value
+		float target_frame_ms{ 33.f };	// that dynamic resolution aims for while the camera moves, and the budget of time budgeted frames
 	} properties;
 
-	static glm::vec3 evaluateRayAlbedo(const Scene&, const Ray&);	// for rendering without shading
-	static glm::vec3 evaluateRay(const Scene&, const Ray&, size_t = 1);		// trace the ray through the scene for x number of bounces
-	static glm::vec3 recursivelySampleRay(const Scene&, const Ray&, size_t, size_t = 1);	// samples at each redirect (much more complex, but much more visually robust)
+	/* Counters for a single render thread, which only it writes to during a frame. Every thread gets its own (cache line
+	* aligned) copy, and they are only added together once the frame is done -- so nothing in the hot path is shared. */
+	struct alignas(64) ThreadStats {
+		TraceStats trace;
+		uint64_t
+			depth_rays[STATS_DEPTHS]{},
+			luminance_exits{ 0 },	// paths that ended on a bright enough emitter
+			shadow_rays{ 0 },	// traced towards sampled lights, not included in depth_rays
+			roulette_exits{ 0 },	// paths terminated by russian roulette
+			cached_hits{ 0 },	// primary hits reused from an earlier frame instead of traced
+			pixels{ 0 },	// traced this frame -- converged ones are skipped when adaptive
+			intersect_ns{ 0 },
+			busy_ns{ 0 };		// time spent in scheduled work
+		size_t bounce_limit{ 0 };	// the 'b' that paths start with, to turn remaining bounces into depth
+
+		inline void traced(size_t b, uint64_t n = 1) { this->depth_rays[std::min<size_t>(this->bounce_limit - b, STATS_DEPTHS - 1)] += n; }
+		inline bool timeNext() const { return (this->trace.rays % STATS_TIMING_STRIDE) == 0; }
+	};
+	struct FrameStats {
+		uint32_t frame{ 0 }, bounce_limit{ 0 },
+			passes{ 0 };	// accumulated within the frame, more than 1 when time budgeted
+		double
+			frame_ms{ 0. },
+			intersect_ms{ 0. },	// summed over every thread
+			shade_ms{ 0. };		// everything else the threads were busy with
+		TraceStats trace;
+		uint64_t
+			depth_rays[STATS_DEPTHS]{},
+			luminance_exits{ 0 },
+			shadow_rays{ 0 },
+			roulette_exits{ 0 },
+			cached_hits{ 0 },
+			pixels{ 0 };
+		std::vector<double> busy_ms;	// per thread, the rest of the frame is idle time
+	};
+
+	static glm::vec3 evaluateRayAlbedo(const Scene&, const Ray&, ThreadStats&);	// for rendering without shading
+	// trace the ray through the scene for x number of bounces, russian roulette starts after the last argument's bounces
+	static glm::vec3 evaluateRay(const Scene&, const Ray&, Rng&, ThreadStats&, size_t = 1, size_t = std::numeric_limits<size_t>::max());
+	static glm::vec3 evaluateHit(const Scene&, const Ray&, const Hit&, Rng&, ThreadStats&, size_t = 1, size_t = std::numeric_limits<size_t>::max());	// same as above, continuing from an already traced hit
+	/* Samples at each redirect (much more complex, but much more visually robust). The last argument is the pdf that the ray
+	* was sampled with if it left a diffuse bounce (where lights are also sampled directly), used to weight any emission
+	* it finds -- 0 for camera rays and specular bounces. */
+	static glm::vec3 recursivelySampleRay(const Scene&, const Ray&, Rng&, ThreadStats&, size_t, size_t = 1, float = 0.f);
+	static glm::vec3 recursivelySampleHit(const Scene&, const Ray&, Hit&, Rng&, ThreadStats&, size_t, size_t = 1, float = 0.f);
+	static glm::vec3 sampleDirect(const Scene&, const Ray&, Hit&, Rng&, ThreadStats&);	// light arriving directly from a sampled emitter at a diffuse bounce (weighted against finding it by bouncing)
 
 
 private:
-	std::shared_ptr<Walnut::Image> image;
+	void renderBlock(const Scene&, const Camera::RayGenerator&, uint32_t tile, uint32_t tile_size, int32_t flags, ThreadStats&);
+	void renderTile(const Scene&, const Camera::RayGenerator&, uint32_t tile, int32_t flags, ThreadStats&);
+	void renderWavefront(const Scene&, const Camera::RayGenerator&, int32_t flags);
+	void renderPass(const Scene&, const Camera::RayGenerator&, int32_t flags, uint64_t frame_start);	// traces every pixel once, unless preempted
+	void runTiles(uint32_t tiles, int32_t flags, const std::function<void(uint32_t tile, ThreadStats&)>& f);	// f for every tile, fewest passes first when time budgeted
+	bool preempted() const;		// if the frame should stop handing out work
+	void mergeStats(double frame_ms, uint32_t passes);
+	uint64_t fingerprint(const Scene&, const Camera::RayGenerator&) const;	// of everything that an accumulation depends on, besides the seed and sampler
+	bool converged(uint32_t idx, int32_t flags) const;	// if adaptive sampling can skip the pixel this frame
+	inline bool skipped(uint32_t idx, int32_t flags) const {	// if the pixel isn't traced this frame
+		return (this->stride > 1 && !this->onGrid(idx % this->width, idx / this->width)) || this->converged(idx, flags);
+	}
+	inline bool onGrid(uint32_t x, uint32_t y) const { return (x & (this->stride - 1)) == this->grid_x && (y & (this->stride - 1)) == this->grid_y; }
+	void updateResolution(const Camera::RayGenerator&, int32_t flags);	// picks the stride and grid position for the frame
+	void fillUntraced();	// gives the pixels that were left out a value to display
+	glm::vec3 accumulate(uint32_t idx, glm::vec3 clr);	// adds a frame's estimate for the pixel and returns the accumulated color
+	Rng pixelRng(uint32_t idx, uint32_t sample, int32_t flags) const;	// generator for one of the pixel's paths this frame, following the selected sampler
+	void publishOutput();	// hands a copy of the render buffer to the reader
+	bool updatePrimaryCache(const Scene&, const Camera::RayGenerator&, int32_t flags);	// drops cached hits that no longer apply, returns if the frame can use the cache
+	void primaryHit(const Scene&, const Ray&, uint32_t idx, Hit&, ThreadStats&);	// the pixel's camera ray hit, from the cache when possible -- at most once per pixel and frame
+	void reproject(const Scene&, const Camera::RayGenerator&, int32_t flags);	// moves the accumulation over to a new view
+	inline bool primaryCached(uint32_t idx) const {		// only entries from earlier frames are read, others may still be written by another thread
+		return this->primary_cache && this->primary_frames[idx] && this->primary_frames[idx] != this->frame_count + 1;
+	}
 
-	//std::vector<std::vector<glm::vec3>> aa_rays;	// randomized directions for antialiasing samples
+	uint32_t width = 0, height = 0;
 
-	mutable std::mutex buffer_read_lock, buffer_write_lock, frame_lock;
-	//std::shared_mutex buffer_write_lock;
 	std::atomic_bool render_interrupt{ false };
+	ThreadPool pool;
+
+	std::vector<uint32_t> buffer;
+	std::vector<glm::vec3> accumulated_samples;
+	std::vector<glm::vec3> accumulated_squares;	// second moment of the per-frame estimates, for the variance
+	std::vector<uint32_t> accumulated_pixel_frames;	// frames that each pixel was actually traced for
 
-	uint32_t* buffer = nullptr;
-	glm::vec3* accumulated_samples = nullptr;
+	/* Triple buffered handoff to readOutput(): a slot only ever changes owner through an atomic exchange with the shared
+	* middle one -- the render thread fills its back slot and swaps it in, and the reader swaps its front slot out when the
+	* middle one is marked fresh. Neither side ever waits on the other. */
+	struct OutputSlot {
+		std::vector<uint32_t> rgba;
+		uint32_t width = 0, height = 0;
+	};
+	static constexpr uint32_t OUTPUT_FRESH = 1U << 2;	// flags the middle index when it holds a frame that hasn't been read
+	std::array<OutputSlot, 3> output_slots;
+	mutable std::atomic<uint32_t> output_middle{ 1 };
+	uint32_t output_back = 0;			// owned by the render thread
+	mutable uint32_t output_front = 2;	// owned by the reader
 	
+	/* First hits of the camera rays, which don't change between frames unless they are jittered. A pixel's entry is filled
+	* in the first time it is traced and reused until the view, scene or size changes. */
+	std::vector<Hit> primary_hits;
+	std::vector<uint32_t> primary_frames;	// frame_count + 1 of the frame that filled each entry, so that 0 always means it hasn't been
+	Camera::RayGenerator primary_view;
+	const Scene* primary_scene = nullptr;
+	std::atomic_bool primary_stale{ true };
+	bool primary_cache = false;		// if the current frame reads and fills the cache
+
+	/* First hit through each pixel of the view that the accumulation belongs to. When the camera moves, every pixel of the
+	* new view looks up the old pixel that its hit projects to, and keeps that history if the old hit lies on the same
+	* primitive and surface -- anything else was disoccluded and starts over. */
+	struct HistoryHit {
+		float depth;
+		uint32_t type, primitive;	// type is Primitive_Count for misses
+	};
+	std::vector<HistoryHit> history_hits, reprojected_hits;
+	std::vector<glm::vec3> reprojected_samples;		// swapped with the accumulation buffers after each reprojection
+	std::vector<glm::vec3> reprojected_squares;
+	std::vector<uint32_t> reprojected_pixel_frames;
+	Camera::RayGenerator history_view;
+	std::atomic_bool history_stale{ true };
+
+	/* Dynamic resolution: while the view keeps changing, only one pixel in every stride x stride block is traced, at a
+	* position that rotates every frame. The others show their own accumulated value if they have one, or their block's
+	* traced pixel otherwise. The stride follows the last frame's time, and once the view holds still it drops back to 1
+	* after every position was traced once. */
+	Camera::RayGenerator motion_view;
+	uint32_t
+		stride = 1,
+		grid_x = 0, grid_y = 0,		// position of the traced pixel in each block this frame
+		grid_phase = 0,
+		still_frames = 0;
+	double last_frame_ms = 0.;
+
+	/* Time budgeted frames: passes after the first one following a reset stop picking up tiles (or wavefront batches) at the
+	* deadline, so the last pass of a frame usually only covers part of the image. Every traced pixel still holds a plain
+	* mean of its own samples, and the next pass starts with the tiles that were left out. */
+	uint64_t deadline_ns = 0;	// 0 when the frame isn't budgeted
+	std::vector<uint32_t>
+		tile_passes,	// per tile, since the tile count last changed
+		tile_order;
+	uint32_t wavefront_resume = 0;	// batch that the next wavefront pass starts at
+
 	uint32_t accumulated_frames = 1;
+	uint32_t frame_count = 0;	// keys the per-pixel generators so that every frame draws new samples
+
+	std::future<bool> checkpoint_write;	// the last save, its destructor waits for it to finish
+
+	std::vector<ThreadStats> thread_stats;	// one per render thread, reset every frame
+	std::deque<FrameStats> stats_history;
+	mutable std::mutex stats_lock;
+
+	struct PathState {
+		Ray ray;
+		glm::vec3
+			throughput{ 1.f },
+			radiance{ 0.f };
+		Rng rng;
+		float pdf{ 0.f };	// of the last diffuse bounce, for weighting emission against light sampling
+		bool alive{ true };
+	};
+	struct {
+		std::vector<PathState> paths;	// pixel_samples consecutive paths per pixel
+		std::vector<Hit> hits;
+		std::vector<uint32_t>
+			queue,		// active paths
+			sorted,		// active paths grouped by material
+			keys,
+			offsets;	// per material
+	} wavefront;	// kept between frames to avoid reallocating
 
 
 };
\ No newline at end of file
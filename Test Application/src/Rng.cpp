@@ -0,0 +1,117 @@
+#include "Rng.h"
+
+#include <vector>
+#include <cmath>
+
+
+const char* const Rng::SEQUENCE_NAMES[Rng::Sequence_Count] = { "Random", "Sobol", "Blue Noise" };
+
+struct SobolBytes {
+	uint32_t v[4 * 256];
+};
+static constexpr SobolBytes sobolBytes() {	// xor of the direction numbers set by every value of each index byte
+	SobolBytes t{};
+	uint32_t m[32]{};
+	m[0] = 1U << 31;
+	for (uint32_t i = 1; i < 32; i++) { m[i] = m[i - 1] ^ (m[i - 1] >> 1); }
+	for (uint32_t b = 0; b < 4; b++) {
+		for (uint32_t v = 0; v < 256; v++) {
+			uint32_t x = 0;
+			for (uint32_t i = 0; i < 8; i++) {
+				if (v & (1U << i)) { x ^= m[b * 8 + i]; }
+			}
+			t.v[b * 256 + v] = x;
+		}
+	}
+	return t;
+}
+static constexpr SobolBytes sobol_bytes = sobolBytes();		// constant initialized, so usable from other static initializers
+const uint32_t* const Rng::SOBOL_BYTES = sobol_bytes.v;
+
+/* Void and cluster (Ulichney 1993): a random initial pattern is relaxed by moving its most clustered point into its
+* largest void until that stops changing anything, then every cell is ranked by the order in which the points would be
+* removed (below the initial count) or added (above it). Thresholding the ranks at any level gives an evenly spread set. */
+static std::vector<uint32_t> voidAndCluster(uint32_t size) {
+	const uint32_t n = size * size;
+	std::vector<float> kernel(n), energy(n, 0.f);
+	for (uint32_t y = 0; y < size; y++) {	// toroidal gaussian (sigma = 1.5) by offset
+		for (uint32_t x = 0; x < size; x++) {
+			const float
+				dx = (float)std::min(x, size - x),
+				dy = (float)std::min(y, size - y);
+			kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.f * 1.5f * 1.5f));
+		}
+	}
+	std::vector<uint8_t> on(n, 0);
+	auto splat = [&](uint32_t p, float sign) {
+		const uint32_t px = p % size, py = p / size;
+		for (uint32_t y = 0; y < size; y++) {
+			const float* k = kernel.data() + ((y - py) & (size - 1)) * size;
+			float* e = energy.data() + y * size;
+			for (uint32_t x = 0; x < size; x++) {
+				e[x] += sign * k[(x - px) & (size - 1)];
+			}
+		}
+	};
+	auto extreme = [&](uint8_t state, bool highest) {	// tightest cluster of the set points or largest void of the unset ones
+		uint32_t best = 0;
+		float e = highest ? -1.f : 1e30f;
+		for (uint32_t p = 0; p < n; p++) {
+			if (on[p] == state && (highest ? energy[p] > e : energy[p] < e)) {
+				e = energy[p];
+				best = p;
+			}
+		}
+		return best;
+	};
+
+	Rng rng{ 0x6e6f6973U, 0 };
+	const uint32_t initial = n / 10;
+	for (uint32_t placed = 0; placed < initial;) {
+		const uint32_t p = rng.next() % n;
+		if (!on[p]) {
+			on[p] = 1;
+			splat(p, 1.f);
+			placed++;
+		}
+	}
+	for (uint32_t i = 0; i < n; i++) {		// relax, bounded in case it cycles
+		const uint32_t c = extreme(1, true);
+		on[c] = 0;
+		splat(c, -1.f);
+		const uint32_t v = extreme(0, false);
+		on[v] = 1;
+		splat(v, 1.f);
+		if (v == c) { break; }
+	}
+
+	std::vector<uint32_t> rank(n);
+	const std::vector<uint8_t> pattern = on;
+	const std::vector<float> pattern_energy = energy;
+	for (uint32_t r = initial; r-- > 0;) {
+		const uint32_t c = extreme(1, true);
+		on[c] = 0;
+		splat(c, -1.f);
+		rank[c] = r;
+	}
+	on = pattern;
+	energy = pattern_energy;
+	for (uint32_t r = initial; r < n; r++) {
+		const uint32_t v = extreme(0, false);
+		on[v] = 1;
+		splat(v, 1.f);
+		rank[v] = r;
+	}
+	return rank;
+}
+
+const uint32_t* Rng::blueNoise() {
+	static const std::vector<uint32_t> tile = []() {
+		static_assert(BLUE_NOISE_SIZE == 64, "rank scaling assumes a 64x64 tile");
+		std::vector<uint32_t> t = voidAndCluster(BLUE_NOISE_SIZE);
+		const uint32_t shift = 32 - 2 * 6;		// 12 bits of rank, centered in their interval
+		for (uint32_t& r : t) { r = (r << shift) | (1U << (shift - 1)); }
+		return t;
+	}();
+	return tile.data();
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+
+/* PCG32 generator (O'Neill, pcg-random.org) that is keyed instead of sharing state: every (seed, pixel, frame, sample)
+* maps to its own stream, so each path owns a generator on the stack and a render only depends on the seed -- not on
+* how pixels were scheduled across threads. Matches the distributions of Walnut::Random that it replaces.
+*
+* A generator can also be switched over to a low discrepancy sequence for its pixel, in which case every Float() is
+* the next dimension of the pixel's index'th sample point instead of a random number. Consumers don't need to know
+* -- a path just has to draw its dimensions in the same order for every sample, which it does. */
+class Rng {
+public:
+	enum Sequence : uint32_t {
+		Sequence_Random = 0,
+		Sequence_Sobol,		// Owen scrambled Sobol (Burley 2020), padded as independently shuffled 2D pairs
+		Sequence_BlueNoise,	// one Sobol sequence for every pixel, shifted by a blue noise tile so that error is spread out in screen space (Georgiev & Fajardo 2016)
+		Sequence_Count
+	};
+	static constexpr uint32_t
+		CAMERA_DIMENSIONS = 2,		// drawn for the pixel jitter before anything else
+		BLUE_NOISE_SIZE = 64;	// tile width and height (power of 2)
+	static const char* const SEQUENCE_NAMES[Sequence_Count];
+
+	inline Rng() : Rng(0, 0) {}
+	inline Rng(uint32_t seed, uint32_t pixel, uint32_t frame = 0, uint32_t sample = 0) {
+		const uint64_t key = mix(((uint64_t)pixel << 32 | frame) ^ mix((uint64_t)sample << 32 | seed));
+		this->inc = (mix(key ^ 0xda3e39cb94b95bdbULL) << 1) | 1U;	// stream select, must be odd
+		this->next();
+		this->state += key;
+		this->next();
+	}
+
+	inline uint32_t next() {
+		const uint64_t old = this->state;
+		this->state = old * 6364136223846793005ULL + this->inc;
+		const uint32_t
+			xorshifted = (uint32_t)(((old >> 18U) ^ old) >> 27U),
+			rot = (uint32_t)(old >> 59U);
+		return (xorshifted >> rot) | (xorshifted << ((~rot + 1U) & 31U));
+	}
+	/* Continue as the index'th point of the pixel's sequence. Sobol points are scrambled per pixel so that neighbors
+	* don't correlate, while blue noise uses the same points everywhere and relies on the (seed keyed) tile shift. */
+	inline void sequence(Sequence s, uint32_t seed, uint32_t x, uint32_t y, uint32_t index) {
+		this->seq = s;
+		this->x = x;
+		this->y = y;
+		this->base = this->index = index;
+		this->dimension = 0;
+		this->pair = ~0U;
+		this->tile = s == Sequence_BlueNoise ? blueNoise() : nullptr;
+		this->scramble = (uint32_t)mix(seed ^ (s == Sequence_Sobol ? mix((uint64_t)y << 32 | x) : 0));
+	}
+	// move on to the sample'th point after the one set above, starting at 'dimension' (random streams just continue)
+	inline void seek(uint32_t sample, uint32_t dimension) {
+		this->index = this->base + sample;
+		this->dimension = dimension;
+		this->pair = ~0U;
+	}
+
+	inline float Float() { return (float)((this->seq ? this->nextDimension() : this->next()) >> 8) * (1.f / 16777216.f); }		// [0, 1)
+	inline glm::vec2 Float2() {		// starts at an even dimension, so that the pair is stratified together when following a sequence
+		this->dimension += this->dimension & 1;
+		return glm::vec2{ this->Float(), this->Float() };
+	}
+	inline float Float(float lo, float hi) { return lo + this->Float() * (hi - lo); }
+	inline glm::vec3 Vec3(float lo, float hi) { return glm::vec3{ this->Float(lo, hi), this->Float(lo, hi), this->Float(lo, hi) }; }
+	inline glm::vec3 InUnitSphere() { return glm::normalize(this->Vec3(-1.f, 1.f)); }
+
+	static inline uint64_t mix(uint64_t z) {	// splitmix64 finalizer
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+
+	static inline uint32_t reverseBits(uint32_t v) {
+		v = (v << 16) | (v >> 16);
+		v = ((v & 0x00ff00ffU) << 8) | ((v & 0xff00ff00U) >> 8);
+		v = ((v & 0x0f0f0f0fU) << 4) | ((v & 0xf0f0f0f0U) >> 4);
+		v = ((v & 0x33333333U) << 2) | ((v & 0xccccccccU) >> 2);
+		return ((v & 0x55555555U) << 1) | ((v & 0xaaaaaaaaU) >> 1);
+	}
+	static inline uint32_t laineKarras(uint32_t v, uint32_t seed) {	// hash where bits only affect more significant ones
+		v += seed;
+		v ^= v * 0x6c50b47cU;
+		v ^= v * 0xb82f1e52U;
+		v ^= v * 0xc7afe638U;
+		v ^= v * 0x8d22f6e6U;
+		return v;
+	}
+	static inline uint32_t owenScramble(uint32_t v, uint32_t seed) {	// nested uniform scramble, most significant bit first
+		return reverseBits(laineKarras(reverseBits(v), seed));
+	}
+	static inline uint32_t sobol1(uint32_t index) {		// second dimension (polynomial x + 1), a byte of the index at a time
+		return
+			SOBOL_BYTES[index & 0xff] ^
+			SOBOL_BYTES[256 + ((index >> 8) & 0xff)] ^
+			SOBOL_BYTES[512 + ((index >> 16) & 0xff)] ^
+			SOBOL_BYTES[768 + (index >> 24)];
+	}
+	static const uint32_t* const SOBOL_BYTES;	// 4 x 256 entries
+	static const uint32_t* blueNoise();		// BLUE_NOISE_SIZE^2 ranks scaled to 32 bits, generated on first use
+
+private:
+	inline uint32_t nextDimension() {
+		const uint32_t d = this->dimension++;
+		if ((d >> 1) != this->pair) {	// both halves of a pair share the shuffle, so they stay stratified together
+			this->pair = d >> 1;
+			this->pair_seed = (uint32_t)mix((uint64_t)this->scramble << 32 | this->pair);
+			this->shuffled = owenScramble(this->index, this->pair_seed);
+		}
+		const uint32_t v = (d & 1) ?
+			owenScramble(sobol1(this->shuffled), this->pair_seed ^ 0x3c6ef372U) :
+			reverseBits(laineKarras(this->shuffled, this->pair_seed ^ 0x9e3779b9U));	// van der Corput is the reversed index, so the scramble's first reversal cancels
+		if (this->seq == Sequence_Sobol) {
+			return v;
+		}
+		const uint32_t
+			o = this->pair_seed >> ((d & 1) * 16),	// tile offset for the dimension -- the same for every pixel
+			mask = BLUE_NOISE_SIZE - 1,
+			tx = (this->x + (o & mask)) & mask,
+			ty = (this->y + ((o >> 8) & mask)) & mask;
+		return v + this->tile[ty * BLUE_NOISE_SIZE + tx];	// toroidal shift, wraps around in fixed point
+	}
+
+	uint64_t state{ 0 }, inc{ 1 };
+	uint32_t
+		seq{ Sequence_Random },
+		x{ 0 }, y{ 0 },
+		base{ 0 }, index{ 0 },
+		dimension{ 0 },
+		scramble{ 0 },
+		pair{ ~0U }, pair_seed{ 0 }, shuffled{ 0 };		// of the current dimension pair
+	const uint32_t* tile{ nullptr };
+
+
+};
\ No newline at end of file
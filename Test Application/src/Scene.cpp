@@ -3,45 +3,113 @@
 #include <string>
 #include <iostream>
 
-#include <imgui.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
 
+#ifndef RT_HEADLESS
+#include <imgui.h>
 #include "Util.h"
+#endif
 
 
-const std::unique_ptr<Material>
-	PhysicalBase::DEFAULT{ std::make_unique<PhysicalBase>() };
-const std::unique_ptr<Texture>
-	StaticColor::DEFAULT{ std::make_unique<StaticColor>() };
-
-
+#ifndef RT_HEADLESS
 bool PhysicalBase::invokeGuiOptions() {
 	return ImGui::DragFloat("Roughness", &this->roughness, 0.005, 0.f, 1.f)
 		|| ImGui::DragFloat("Glossiness", &this->glossiness, 0.005, 0.f, 1.f)
 		|| ImGui::DragFloat("Transparency", &this->transparency, 0.005, 0.f, 1.f)
 		|| ImGui::DragFloat("Refraction Index", &this->refraction_index, 0.005, 0.5, 10.f);
 }
+#endif
+
+static inline void orthonormalBasis(const glm::vec3& n, glm::vec3& t, glm::vec3& b) {	// branchless (Duff et al. 2017)
+	const float
+		sign = std::copysign(1.f, n.z),
+		a = -1.f / (sign + n.z),
+		c = n.x * n.y * a;
+	t = glm::vec3{ 1.f + sign * n.x * n.x * a, sign * c, -sign * n.x };
+	b = glm::vec3{ c, sign + n.y * n.y * a, -n.y };
+}
+static inline glm::vec3 ggxNormal(const glm::vec3& n, float alpha, Rng& rng) {	// distributed by D(m) * cos(m) around n
+	const glm::vec2 u = rng.Float2();
+	const float
+		cos2 = (1.f - u.x) / (1.f + (alpha * alpha - 1.f) * u.x),
+		sin = std::sqrt(std::max(1.f - cos2, 0.f)),
+		phi = 2.f * glm::pi<float>() * u.y;
+	glm::vec3 t, b;
+	orthonormalBasis(n, t, b);
+	return t * (sin * std::cos(phi)) + b * (sin * std::sin(phi)) + n * std::sqrt(cos2);
+}
+static inline float ggxD(float cos, float alpha) {
+	const float
+		a2 = alpha * alpha,
+		d = cos * cos * (a2 - 1.f) + 1.f;
+	return a2 / (glm::pi<float>() * d * d);
+}
 
-bool PhysicalBase::redirect(const Ray& src, const Hit& hit, Ray& out) const {
-	float seed = Walnut::Random::Float();
+bool PhysicalBase::redirect(const Ray& src, const Hit& hit, Ray& out, Rng& rng, Lobe& lobe) const {
+	const float seed = rng.Float();
+	lobe.type = this->glossiness > 0.f ? Lobe_Glossy : Lobe_Specular;
 	if (seed < this->roughness) {
-		return diffuse(hit.normal, out);
+		lobe.type = Lobe_Diffuse;
+		diffuse(hit.normal, out, rng);
 	} else if(seed < this->transparency) {
-		return refract(src, hit, this->refraction_index, out, this->glossiness);
+		if (!refract(src, hit, this->refraction_index, out, rng, this->glossiness)) { return false; }
 	} else {
-		return reflect(src, hit, out, this->glossiness);
+		if (!reflect(src, hit, out, rng, this->glossiness)) { return false; }
+	}
+	lobe.pdf = this->pdf(src, hit, out.direction, lobe.type);
+	return true;
+}
+float PhysicalBase::pdf(const Ray& src, const Hit& hit, const glm::vec3& direction, uint32_t lobe) const {
+	const glm::vec3
+		& n = hit.normal.direction,
+		o = glm::normalize(direction);
+	if (lobe == Lobe_Diffuse) {
+		return std::max(glm::dot(n, o), 0.f) * glm::one_over_pi<float>();
+	}
+	if (lobe != Lobe_Glossy) {
+		return 0.f;
 	}
+	const glm::vec3 i = -glm::normalize(src.direction);
+	if (glm::dot(o, n) > 0.f) {		// reflected about the halfway vector
+		const glm::vec3 m = glm::normalize(i + o);
+		const float cos = glm::dot(m, n);
+		return ggxD(cos, this->glossiness) * cos / (4.f * std::abs(glm::dot(o, m)));
+	}
+	if (this->transparency <= this->roughness) {
+		return 0.f;		// opaque
+	}
+	// refracted -- the halfway vector is weighted by the relative index (Walter et al. 2007)
+	const float e = hit.reverse_intersect ? this->refraction_index : (1.f / this->refraction_index);
+	glm::vec3 m = glm::normalize(-(e * i + o));
+	m *= sgn(glm::dot(m, n));
+	const float
+		cos = glm::dot(m, n),
+		im = glm::dot(i, m),
+		om = glm::dot(o, m),
+		denom = e * im + om;
+	if (im <= 0.f || om >= 0.f || denom == 0.f) {
+		return 0.f;		// no microfacet refracts into this direction
+	}
+	return ggxD(cos, this->glossiness) * cos * -om / (denom * denom);
 }
-bool PhysicalBase::diffuse(const Ray& n, Ray& out) {
+bool PhysicalBase::diffuse(const Ray& n, Ray& out, Rng& rng) {	// cosine weighted, mapped straight from the unit square
+	const glm::vec2 u = rng.Float2();
+	const float
+		r = std::sqrt(u.x),
+		phi = 2.f * glm::pi<float>() * u.y;
+	glm::vec3 t, b;
+	orthonormalBasis(n.direction, t, b);
 	out.origin = n.origin;
-	out.direction = n.direction + Walnut::Random::InUnitSphere();
-	if (fabs(out.direction.x) < 1e-5f && fabs(out.direction.y) < 1e-5f && fabs(out.direction.z) < 1e-5f) { out.direction = n.direction; }
+	out.direction = t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + n.direction * std::sqrt(std::max(1.f - u.x, 0.f));
 	return true;
 }
-bool PhysicalBase::reflect(const Ray& src, const Hit& hit, Ray& out, float g) {
+bool PhysicalBase::reflect(const Ray& src, const Hit& hit, Ray& out, Rng& rng, float g) {
+	const glm::vec3& n = hit.normal.direction;
 	out.origin = hit.normal.origin;
-	out.direction = glm::reflect(src.direction, hit.normal.direction) + (g * Walnut::Random::InUnitSphere());
-	return glm::dot(out.direction, hit.normal.direction) > 0;
+	out.direction = glm::reflect(src.direction, g > 0.f ? ggxNormal(n, g, rng) : n);
+	return glm::dot(out.direction, n) > 0;
 }
 inline static float reflectance(float cos, float ir) {
 	return
@@ -49,23 +117,30 @@ inline static float reflectance(float cos, float ir) {
 			+ (1.f - ir) * pow((1.f - cos), 5)
 	;
 }
-bool PhysicalBase::refract(const Ray& src, const Hit& hit, float ir, Ray& out, float g) {
-	float cos_theta = fmin(glm::dot(-src.direction, hit.normal.direction), 1.0);
+bool PhysicalBase::refract(const Ray& src, const Hit& hit, float ir, Ray& out, Rng& rng, float g) {
+	const glm::vec3
+		& n = hit.normal.direction,
+		m = g > 0.f ? ggxNormal(n, g, rng) : n;		// both the reflection and the refraction happen at the sampled microfacet
+	float cos_theta = fmin(glm::dot(-src.direction, m), 1.0);
+	if (cos_theta <= 0.f) { return false; }		// facing away from the ray
 	float sin_theta = sqrt(1.f - cos_theta * cos_theta);
 	ir = hit.reverse_intersect ? ir : (1.f / ir);
-	if (ir * sin_theta > 1.f || reflectance(cos_theta, ir) > Walnut::Random::Float()) {
-		return reflect(src, hit, out, g);
+	out.origin = hit.normal.origin;
+	if (ir * sin_theta > 1.f || reflectance(cos_theta, ir) > rng.Float()) {
+		out.direction = glm::reflect(src.direction, m);
+		return glm::dot(out.direction, n) > 0;
 	}
-	glm::vec3 r_out_perp = ir * (src.direction + cos_theta * hit.normal.direction);
-	glm::vec3 r_out_para = -(float)sqrt(fabs(1.0 - glm::dot(r_out_perp, r_out_perp))) * hit.normal.direction;
+	glm::vec3 r_out_perp = ir * (src.direction + cos_theta * m);
+	glm::vec3 r_out_para = -(float)sqrt(fabs(1.0 - glm::dot(r_out_perp, r_out_perp))) * m;
 	out.direction = r_out_perp + r_out_para;
-	out.origin = hit.normal.origin;
-	return true;
+	return glm::dot(out.direction, n) < 0;
 }
 
+#ifndef RT_HEADLESS
 bool StaticColor::invokeGuiOptions() {
 	return ImGui::ColorEdit3("Albedo", glm::value_ptr(this->color));
 }
+#endif
 
 glm::vec3 ImageTexture::albedo(glm::vec2 uv) const {
 	if (!this->data || this->width < 1 || this->height < 1) { return glm::vec3{ 0.5f }; }
@@ -81,6 +156,7 @@ glm::vec3 ImageTexture::albedo(glm::vec2 uv) const {
 		pix[2] / 255.f
 	};
 }
+#ifndef RT_HEADLESS
 bool ImageTexture::invokeGuiOptions() {
 	if (ImGui::Button("Load Texture Image")) {
 		std::string f;
@@ -104,6 +180,8 @@ bool ImageTexture::invokeGuiOptions() {
 	}
 	return false;
 }
+#endif
+
 
 
 const Interactable* Sphere::interacts(const Ray& r, Hit& h, float t_min, float t_max) const {
@@ -125,6 +203,13 @@ const Interactable* Sphere::interacts(const Ray& r, Hit& h, float t_min, float t
 	// h.hit_normal.origin += h.hit_normal.direction * 1e-5f;	// no collide
 	return this;
 }
+AABB Sphere::bounds() const {
+	const glm::vec3 r{ std::abs(this->radius) };
+	return AABB{ this->position - r, this->position + r };
+}
+void Sphere::compile(PrimitiveStore& store) const {
+	store.addSphere(this->position, this->radius, this->mat, this->tex, this->luminance);
+}
 glm::vec3 Sphere::albedo(Hit& hit) const {
 	if (!this->tex) {
 		return glm::vec3{ 0.f };
@@ -138,24 +223,33 @@ glm::vec3 Sphere::albedo(Hit& hit) const {
 	return this->tex->albedo(hit.uv);
 }
 
-const Interactable* Triangle::interacts(const Ray& r, Hit& hr, float t_min, float t_max) const {
+bool Triangle::intersect(
+	const glm::vec3& p1, const glm::vec3& e1, const glm::vec3& e2,
+	const Ray& r, float t_min, float t_max, float& t, glm::vec2& uv
+) {
 	constexpr float EPSILON = 1e-5f;
 	glm::vec3 h, s, q;
 	float a, f, u, v;
 
-	h = glm::cross(r.direction, this->e2);
-	a = glm::dot(this->e1, h);
-	if (a > -EPSILON && a < EPSILON) { return nullptr; }
+	h = glm::cross(r.direction, e2);
+	a = glm::dot(e1, h);
+	if (a > -EPSILON && a < EPSILON) { return false; }
 	f = 1.f / a;
 	s = r.origin - p1;
 	u = f * glm::dot(s, h);
-	if (u < 0.f || u > 1.f) { return nullptr; }
-	q = glm::cross(s, this->e1);
+	if (u < 0.f || u > 1.f) { return false; }
+	q = glm::cross(s, e1);
 	v = f * glm::dot(r.direction, q);
-	if (v < 0.f || u + v > 1.f) { return nullptr; }
+	if (v < 0.f || u + v > 1.f) { return false; }
 
-	hr.ptime = f * glm::dot(this->e2, q);
-	if (hr.ptime <= EPSILON || hr.ptime < t_min || hr.ptime > t_max) { return nullptr; }
+	t = f * glm::dot(e2, q);
+	if (t <= EPSILON || t < t_min || t > t_max) { return false; }
+	uv = glm::vec2{ u, v };
+	return true;
+}
+const Interactable* Triangle::interacts(const Ray& r, Hit& hr, float t_min, float t_max) const {
+	glm::vec2 uv;
+	if (!intersect(this->p1, this->e1, this->e2, r, t_min, t_max, hr.ptime, uv)) { return nullptr; }
 	hr.normal.origin = r.origin + r.direction * hr.ptime;
 	hr.normal.direction = this->norm * -sgn(glm::dot(this->norm, r.direction));
 	// h.hit_normal.origin += h.hit_normal.direction * 1e-5f;	// no collide
@@ -163,6 +257,16 @@ const Interactable* Triangle::interacts(const Ray& r, Hit& hr, float t_min, floa
 	//hr.surface = this->mat;
 	return this;
 }
+AABB Triangle::bounds() const {
+	AABB b;
+	b.extend(this->p1);
+	b.extend(this->p2);
+	b.extend(this->p3);
+	return b;
+}
+void Triangle::compile(PrimitiveStore& store) const {
+	store.addTriangle(this->p1, this->p2, this->p3, this->mat, this->tex, this->luminance);
+}
 glm::vec3 Triangle::albedo(Hit& hit) const {
 	if (!this->tex) {
 		return glm::vec3{ 0.f };
@@ -177,6 +281,163 @@ const Interactable* Quad::interacts(const Ray& source, Hit& hit, float t_min, fl
 	const Interactable* v = this->h1.interacts(source, hit, t_min, t_max);
 	return v ? v : this->h2.interacts(source, hit, t_min, t_max);
 }
+AABB Quad::bounds() const {
+	AABB b = this->h1.bounds();
+	b.extend(this->h2.bounds());
+	return b;
+}
+void Quad::compile(PrimitiveStore& store) const {
+	// h1 is (p1, p2, p4) and h2 is (p3, p2, p4) -- texcoords run from p1 at the origin to p3 at (1, 1)
+	store.addTriangle(this->h1.p1, this->h1.p2, this->h1.p3, this->h1.mat, this->h1.tex, this->h1.luminance,
+		glm::vec2{ 0.f, 0.f }, glm::vec2{ 1.f, 0.f }, glm::vec2{ 0.f, 1.f });
+	store.addTriangle(this->h2.p1, this->h2.p2, this->h2.p3, this->h2.mat, this->h2.tex, this->h2.luminance,
+		glm::vec2{ 1.f, 1.f }, glm::vec2{ 1.f, 0.f }, glm::vec2{ 0.f, 1.f });
+}
+
+Mesh::Mesh(const std::vector<glm::vec3>& verts, const std::vector<uint32_t>& idx, const std::vector<glm::vec2>& tc, Material* m, Texture* t) :
+	mat(m), tex(t)
+{
+	const uint32_t n = (uint32_t)idx.size() / 3;
+	std::vector<AABB> bounds(n);
+	this->normal.reserve(n);
+	for (uint32_t i = 0; i < n; i++) {
+		const glm::vec3
+			&a = verts[idx[i * 3]],
+			&b = verts[idx[i * 3 + 1]],
+			&c = verts[idx[i * 3 + 2]];
+		this->normal.push_back(glm::normalize(glm::cross(b - a, c - a)));
+		if (!tc.empty()) {
+			this->t0.push_back(tc[idx[i * 3]]);
+			this->te1.push_back(tc[idx[i * 3 + 1]] - tc[idx[i * 3]]);
+			this->te2.push_back(tc[idx[i * 3 + 2]] - tc[idx[i * 3]]);
+		}
+		bounds[i].extend(a);
+		bounds[i].extend(b);
+		bounds[i].extend(c);
+	}
+	this->bvh.setLeafWidth(IntersectKernels::active().width);
+	this->bvh.build(bounds);
+
+	const std::vector<uint32_t>& order = this->bvh.getIndices();
+	this->packed.resize(n);
+	for (uint32_t l = 0; l < n; l++) {
+		const uint32_t i = order[l];
+		const glm::vec3
+			&a = verts[idx[i * 3]],
+			e1 = verts[idx[i * 3 + 1]] - a,
+			e2 = verts[idx[i * 3 + 2]] - a;
+		const float lane[PackedTriangles::COMPONENTS] = { a.x, a.y, a.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z };
+		for (uint32_t c = 0; c < PackedTriangles::COMPONENTS; c++) {
+			this->packed[c][l] = lane[c];
+		}
+		this->packed.lane_of[i] = l;
+	}
+}
+const std::shared_ptr<const Mesh>& Mesh::unitQuad() {
+	static const std::shared_ptr<const Mesh> quad = std::make_shared<Mesh>(
+		std::vector<glm::vec3>{ { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 } },
+		std::vector<uint32_t>{ 0, 1, 2, 0, 2, 3 },
+		std::vector<glm::vec2>{ { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } }
+	);
+	return quad;
+}
+const std::shared_ptr<const Mesh>& Mesh::unitCube() {
+	static const std::shared_ptr<const Mesh> cube = std::make_shared<Mesh>(
+		std::vector<glm::vec3>{
+			{ -0.5f, -0.5f, -0.5f }, { 0.5f, -0.5f, -0.5f }, { 0.5f, 0.5f, -0.5f }, { -0.5f, 0.5f, -0.5f },
+			{ -0.5f, -0.5f, 0.5f }, { 0.5f, -0.5f, 0.5f }, { 0.5f, 0.5f, 0.5f }, { -0.5f, 0.5f, 0.5f }
+		},
+		std::vector<uint32_t>{
+			0, 2, 1, 0, 3, 2,	// -z
+			4, 5, 6, 4, 6, 7,	// +z
+			0, 1, 5, 0, 5, 4,	// -y
+			3, 6, 2, 3, 7, 6,	// +y
+			0, 4, 7, 0, 7, 3,	// -x
+			1, 2, 6, 1, 6, 5	// +x
+		}
+	);
+	return cube;
+}
+bool Mesh::intersect(const Ray& r, Hit& h, float t_min, float t_max, TraceStats* stats) const {
+	const IntersectKernels& k = IntersectKernels::active();
+	float closest = t_max;
+	glm::vec2 uv;
+	int32_t lane = -1;
+	this->bvh.traverseLeaves(r.origin, r.direction, t_min, closest,
+		[&](uint32_t first, uint32_t count) {
+			if (stats) { stats->primitive_tests += count; }
+			const int32_t l = k.triangles(this->packed, first, count, r.origin, r.direction, t_min, closest, uv);
+			if (l >= 0) { lane = l; }
+		},
+		stats ? &stats->nodes_visited : nullptr
+	);
+	if (lane < 0) { return false; }
+	const uint32_t tri = this->bvh.getIndices()[lane];
+	h.ptime = closest;
+	h.normal.direction = this->normal[tri];
+	h.uv = this->t0.empty() ? uv : this->t0[tri] + this->te1[tri] * uv.x + this->te2[tri] * uv.y;
+	return true;
+}
+
+Instance::Instance(std::shared_ptr<const Mesh> mesh, glm::vec3 p, glm::vec3 r, glm::vec3 s, Material* m, Texture* t, float l, const glm::mat4& base) :
+	mesh(std::move(mesh)), position(p), rotation(r), scale(s), base(base), luminance(l), mat(m), tex(t)
+{
+	this->updateTransform();
+}
+std::shared_ptr<Instance> Instance::fromQuad(glm::vec3 p, glm::vec3 a, glm::vec3 b, Material* m, Texture* t, float l) {
+	const glm::vec3		// the fourth corner is a + b - p
+		u = a - p,
+		v = b - p,
+		w = glm::normalize(glm::cross(u, v));
+	return std::make_shared<Instance>(Mesh::unitQuad(), p, glm::vec3{ 0.f }, glm::vec3{ 1.f }, m, t, l,
+		glm::mat4{ glm::vec4{ u, 0.f }, glm::vec4{ v, 0.f }, glm::vec4{ w, 0.f }, glm::vec4{ 0.f, 0.f, 0.f, 1.f } });
+}
+void Instance::updateTransform() {
+	this->transform =
+		glm::translate(glm::mat4{ 1.f }, this->position) *
+		glm::rotate(glm::mat4{ 1.f }, glm::radians(this->rotation.z), glm::vec3{ 0.f, 0.f, 1.f }) *
+		glm::rotate(glm::mat4{ 1.f }, glm::radians(this->rotation.y), glm::vec3{ 0.f, 1.f, 0.f }) *
+		glm::rotate(glm::mat4{ 1.f }, glm::radians(this->rotation.x), glm::vec3{ 1.f, 0.f, 0.f }) *
+		glm::scale(glm::mat4{ 1.f }, this->scale) *
+		this->base;
+	this->inverse = glm::inverse(this->transform);
+	this->normal_matrix = glm::transpose(glm::mat3{ this->inverse });
+}
+const Interactable* Instance::interacts(const Ray& r, Hit& h, float t_min, float t_max) const {
+	const Ray local{		// direction is left unnormalized so distances carry over between spaces
+		glm::vec3{ this->inverse * glm::vec4{ r.origin, 1.f } },
+		glm::vec3{ this->inverse * glm::vec4{ r.direction, 0.f } }
+	};
+	if (!this->mesh->intersect(local, h, t_min, t_max)) { return nullptr; }
+	const glm::vec3 n = glm::normalize(this->normal_matrix * h.normal.direction);
+	h.normal.origin = r.origin + r.direction * h.ptime;
+	h.normal.direction = n * -sgn(glm::dot(n, r.direction));
+	h.reverse_intersect = false;
+	return this;
+}
+AABB Instance::bounds() const {
+	const AABB local = this->mesh->bounds();
+	AABB b;
+	for (int i = 0; i < 8; i++) {
+		b.extend(glm::vec3{ this->transform * glm::vec4{
+			(i & 1) ? local.max.x : local.min.x,
+			(i & 2) ? local.max.y : local.min.y,
+			(i & 4) ? local.max.z : local.min.z,
+			1.f
+		} });
+	}
+	return b;
+}
+void Instance::compile(PrimitiveStore& store) const {
+	store.addInstance(this->mesh.get(), this->inverse, this->bounds(), this->material(), this->texture(), this->luminance);
+}
+glm::vec3 Instance::albedo(Hit& hit) const {
+	const Texture* t = this->texture();
+	if (!t) {
+		return glm::vec3{ 0.f };
+	}
+	return t->albedo(hit.uv);
+}
 glm::vec3 Quad::albedo(Hit& hit) const {
 	glm::vec3 a = this->h1.albedo(hit);
 	if (a == glm::vec3{ 0.f }) {
@@ -202,6 +463,7 @@ void Quad::move(glm::vec3 p) {
 	this->h2.p3 += p;
 }
 
+#ifndef RT_HEADLESS
 bool Sphere::invokeGuiOptions() {
 	bool r = false;
 	if (ImGui::BeginDragDropTarget()) {
@@ -331,50 +593,634 @@ bool Quad::invokeGuiOptions() {
 	}
 	return r;
 }
+bool Instance::invokeGuiOptions() {
+	bool r = false;
+	if (ImGui::BeginDragDropTarget()) {
+		if (const ImGuiPayload* payload = ImGui::AcceptDragDropPayload("MATERIAL_PTR_PTR")) {
+			if (payload->DataSize == sizeof(Material*)) {
+				this->mat = *((Material**)(payload->Data));
+				r = true;
+			}
+		}
+		if (const ImGuiPayload* payload = ImGui::AcceptDragDropPayload("TEXTURE_PTR_PTR")) {
+			if (payload->DataSize == sizeof(Texture*)) {
+				this->tex = *((Texture**)(payload->Data));
+				r = true;
+			}
+		}
+		ImGui::EndDragDropTarget();
+	}
+	ImGui::Text("Mesh: %zu triangles (shared by %ld instances)", this->mesh->size(), this->mesh.use_count());
+	bool moved = false;
+	moved |= ImGui::DragFloat3("Position", glm::value_ptr(this->position), 0.05);
+	moved |= ImGui::DragFloat3("Rotation", glm::value_ptr(this->rotation), 0.5);
+	moved |= ImGui::DragFloat3("Scale", glm::value_ptr(this->scale), 0.01, 1e-3f, 1e3f);
+	if (moved) {
+		this->updateTransform();
+		r = true;
+	}
+	r |= ImGui::DragFloat("Luminance", &this->luminance, 0.05, 0, 100);
+	if (ImGui::Button("Reset Mat") && this->mat) {
+		this->mat = nullptr;	// back to the mesh's material
+		r = true;
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Reset Texture") && this->tex) {
+		this->tex = nullptr;
+		r = true;
+	}
+	if (Material* m = this->material(); m && ImGui::TreeNode("Material Editor")) {
+		r |= m->invokeGuiOptions();
+		ImGui::TreePop();
+		ImGui::Separator();
+	}
+	if (Texture* t = this->texture(); t && ImGui::TreeNode("Texture Editor")) {
+		r |= t->invokeGuiOptions();
+		ImGui::TreePop();
+		ImGui::Separator();
+	}
+	return r;
+}
+#endif
+
+
+
+void PrimitiveStore::Surfaces::resize(size_t n) {
+	this->bounds.resize(n);
+	this->material.resize(n);
+	this->texture.resize(n);
+	this->object.resize(n);
+	this->luminance.resize(n);
+}
+void PrimitiveStore::Spheres::resize(size_t n) {
+	Surfaces::resize(n);
+	this->x.resize(n);
+	this->y.resize(n);
+	this->z.resize(n);
+	this->radius.resize(n);
+}
+void PrimitiveStore::Triangles::resize(size_t n) {
+	Surfaces::resize(n);
+	for (std::vector<float>* v : { &this->v0x, &this->v0y, &this->v0z, &this->e1x, &this->e1y, &this->e1z,
+		&this->e2x, &this->e2y, &this->e2z, &this->nx, &this->ny, &this->nz })
+	{
+		v->resize(n);
+	}
+	this->t0.resize(n);
+	this->te1.resize(n);
+	this->te2.resize(n);
+}
+void PrimitiveStore::Instances::resize(size_t n) {
+	Surfaces::resize(n);
+	this->mesh.resize(n);
+	this->inverse.resize(n);
+	this->normal_matrix.resize(n);
+}
+
+void PrimitiveStore::build(const std::vector<std::shared_ptr<Interactable>>& objs) {
+	this->spheres.resize(0);
+	this->triangles.resize(0);
+	this->instances.resize(0);
+	this->materials.assign(1, nullptr);
+	this->textures.assign(1, nullptr);
+	this->ranges.assign(objs.size(), Range{});
+	this->updating = false;
+	for (this->compiling = 0; this->compiling < objs.size(); this->compiling++) {
+		this->written = 0;
+		objs[this->compiling]->compile(*this);
+	}
+	const uint32_t width = IntersectKernels::active().width;
+	this->bvh[Primitive_Sphere].setLeafWidth(width);
+	this->bvh[Primitive_Triangle].setLeafWidth(width);
+	const auto landing = [this](PrimitiveType t) {	// the packed lanes are filled in before their tree becomes active
+		return [this, t](const BVH&, uint32_t slot) { this->pack(t, slot); };
+	};
+	this->bvh[Primitive_Sphere].build(this->spheres.bounds, landing(Primitive_Sphere));
+	this->bvh[Primitive_Triangle].build(this->triangles.bounds, landing(Primitive_Triangle));
+	this->bvh[Primitive_Instance].build(this->instances.bounds);
+	this->collectLights();
+}
+bool PrimitiveStore::update(uint32_t obj, const Interactable& o) {
+	const Range r = this->ranges[obj];
+	this->compiling = obj;
+	this->written = 0;
+	this->updating = true;
+	o.compile(*this);
+	this->updating = false;
+	if (this->written != r.count) {
+		return false;	// the object's layout changed -- needs a full build
+	}
+	const Surfaces& s = this->surfaces(r.type);
+	for (uint32_t i = r.first; i < r.first + r.count; i++) {
+		this->packPrimitive((PrimitiveType)r.type, this->bvh[r.type].activeSlot(), i);
+		this->bvh[r.type].refit(i, s.bounds[i], BVH_REBUILD_THRESHOLD);
+	}
+	this->collectLights();	// luminance may have been edited
+	return true;
+}
+bool PrimitiveStore::poll() {
+	bool r = false;
+	for (uint32_t t = 0; t < Primitive_Count; t++) {
+		r |= this->bvh[t].poll(
+			[this, t](const BVH&, uint32_t slot) { this->pack((PrimitiveType)t, slot); });	// the store already has every edit made during the rebuild
+	}
+	return r;
+}
+void PrimitiveStore::pack(PrimitiveType t, uint32_t slot) {
+	const std::vector<uint32_t>& order = this->bvh[t].get(slot).getIndices();
+	if (t == Primitive_Sphere) {
+		this->packed_spheres[slot].resize((uint32_t)order.size());
+	} else if (t == Primitive_Triangle) {
+		this->packed_triangles[slot].resize((uint32_t)order.size());
+	} else {
+		return;		// instances are tested one at a time
+	}
+	for (uint32_t l = 0; l < (uint32_t)order.size(); l++) {
+		(t == Primitive_Sphere ? this->packed_spheres[slot].lane_of : this->packed_triangles[slot].lane_of)[order[l]] = l;
+		this->packPrimitive(t, slot, order[l]);
+	}
+}
+void PrimitiveStore::packPrimitive(PrimitiveType t, uint32_t slot, uint32_t i) {
+	if (t == Primitive_Sphere) {
+		PackedSpheres& p = this->packed_spheres[slot];
+		const uint32_t l = p.lane_of[i];
+		p[0][l] = this->spheres.x[i];
+		p[1][l] = this->spheres.y[i];
+		p[2][l] = this->spheres.z[i];
+		p[3][l] = this->spheres.radius[i];
+	} else if (t == Primitive_Triangle) {
+		PackedTriangles& p = this->packed_triangles[slot];
+		const Triangles& s = this->triangles;
+		const uint32_t l = p.lane_of[i];
+		p[0][l] = s.v0x[i];	p[1][l] = s.v0y[i];	p[2][l] = s.v0z[i];
+		p[3][l] = s.e1x[i];	p[4][l] = s.e1y[i];	p[5][l] = s.e1z[i];
+		p[6][l] = s.e2x[i];	p[7][l] = s.e2y[i];	p[8][l] = s.e2z[i];
+	}
+}
+uint32_t PrimitiveStore::slot(PrimitiveType t, Material* m, Texture* x, float l, const AABB& b) {
+	Range& r = this->ranges[this->compiling];
+	Surfaces& s = t == Primitive_Sphere ? (Surfaces&)this->spheres :
+		t == Primitive_Triangle ? (Surfaces&)this->triangles : (Surfaces&)this->instances;
+	uint32_t i;
+	if (this->updating) {
+		if (r.type != t || this->written >= r.count) {
+			this->written = ~0U;
+			return ~0U;
+		}
+		i = r.first + this->written;
+	} else {
+		if (r.count == 0) {
+			r.type = t;
+			r.first = (uint32_t)s.size();
+		} else if (r.type != t) {
+			return ~0U;		// objects only own a single primitive type
+		}
+		i = r.first + r.count++;
+		switch (t) {
+			case Primitive_Sphere: this->spheres.resize(i + 1); break;
+			case Primitive_Triangle: this->triangles.resize(i + 1); break;
+			default: this->instances.resize(i + 1);
+		}
+	}
+	this->written++;
+	s.bounds[i] = b;
+	s.material[i] = this->materialID(m);
+	s.texture[i] = this->textureID(x);
+	s.object[i] = this->compiling;
+	s.luminance[i] = l;
+	return i;
+}
+uint32_t PrimitiveStore::materialID(Material* m) {
+	if (!m) { return 0; }
+	for (uint32_t i = 1; i < this->materials.size(); i++) {		// there are only ever a handful
+		if (this->materials[i] == m) { return i; }
+	}
+	this->materials.push_back(m);
+	return (uint32_t)this->materials.size() - 1;
+}
+uint32_t PrimitiveStore::textureID(Texture* t) {
+	if (!t) { return 0; }
+	for (uint32_t i = 1; i < this->textures.size(); i++) {
+		if (this->textures[i] == t) { return i; }
+	}
+	this->textures.push_back(t);
+	return (uint32_t)this->textures.size() - 1;
+}
+void PrimitiveStore::addSphere(const glm::vec3& c, float r, Material* m, Texture* t, float l) {
+	const glm::vec3 e{ std::abs(r) };
+	const uint32_t i = this->slot(Primitive_Sphere, m, t, l, AABB{ c - e, c + e });
+	if (i == ~0U) { return; }
+	Spheres& s = this->spheres;
+	s.x[i] = c.x;
+	s.y[i] = c.y;
+	s.z[i] = c.z;
+	s.radius[i] = r;
+}
+void PrimitiveStore::addTriangle(
+	const glm::vec3& a, const glm::vec3& b, const glm::vec3& c,
+	Material* m, Texture* t, float l,
+	const glm::vec2& ta, const glm::vec2& tb, const glm::vec2& tc
+) {
+	AABB bounds;
+	bounds.extend(a);
+	bounds.extend(b);
+	bounds.extend(c);
+	const uint32_t i = this->slot(Primitive_Triangle, m, t, l, bounds);
+	if (i == ~0U) { return; }
+	Triangles& s = this->triangles;
+	const glm::vec3
+		e1 = b - a,
+		e2 = c - a,
+		n = glm::normalize(glm::cross(e1, e2));
+	s.v0x[i] = a.x;		s.v0y[i] = a.y;		s.v0z[i] = a.z;
+	s.e1x[i] = e1.x;	s.e1y[i] = e1.y;	s.e1z[i] = e1.z;
+	s.e2x[i] = e2.x;	s.e2y[i] = e2.y;	s.e2z[i] = e2.z;
+	s.nx[i] = n.x;		s.ny[i] = n.y;		s.nz[i] = n.z;
+	s.t0[i] = ta;
+	s.te1[i] = tb - ta;
+	s.te2[i] = tc - ta;
+}
+void PrimitiveStore::addInstance(const Mesh* mesh, const glm::mat4& inverse, const AABB& b, Material* m, Texture* t, float l) {
+	const uint32_t i = this->slot(Primitive_Instance, m, t, l, b);
+	if (i == ~0U) { return; }
+	Instances& s = this->instances;
+	s.mesh[i] = mesh;
+	s.inverse[i] = inverse;
+	s.normal_matrix[i] = glm::transpose(glm::mat3{ inverse });
+}
+
+void PrimitiveStore::collectLights() {
+	this->lights.clear();
+	for (uint32_t i = 0; i < this->spheres.size(); i++) {
+		if (this->spheres.luminance[i] > 0.f) { this->lights.emplace_back(Primitive_Sphere, i); }
+	}
+	for (uint32_t i = 0; i < this->triangles.size(); i++) {
+		if (this->triangles.luminance[i] > 0.f) { this->lights.emplace_back(Primitive_Triangle, i); }
+	}
+}
+
+static inline float conePdf(float d2, float r2) {	// uniform over the cone a sphere subtends, 0 from inside it
+	if (d2 <= r2) { return 0.f; }
+	const float
+		cos_max = std::sqrt(1.f - r2 / d2),
+		solid = 2.f * glm::pi<float>() * (r2 / d2) / (1.f + cos_max);	// 2pi * (1 - cos_max) without the cancellation
+	return 1.f / solid;
+}
+bool PrimitiveStore::sampleLight(const glm::vec3& from, Rng& rng, LightSample& ls) const {
+	if (this->lights.empty()) { return false; }
+	const uint32_t n = (uint32_t)this->lights.size();
+	const std::pair<uint32_t, uint32_t> l = this->lights[std::min((uint32_t)(rng.Float() * n), n - 1)];
+	const uint32_t i = l.second;
+	const glm::vec2 u = rng.Float2();
+	ls.type = l.first;
+	ls.primitive = i;
+	if (l.first == Primitive_Sphere) {
+		const Spheres& sp = this->spheres;
+		const glm::vec3 w = glm::vec3{ sp.x[i], sp.y[i], sp.z[i] } - from;
+		const float
+			d2 = glm::dot(w, w),
+			r2 = sp.radius[i] * sp.radius[i],
+			pdf = conePdf(d2, r2);
+		if (pdf <= 0.f) { return false; }
+		const float
+			cos_t = 1.f - u.x * (1.f - std::sqrt(1.f - r2 / d2)),
+			sin_t = std::sqrt(std::max(1.f - cos_t * cos_t, 0.f)),
+			phi = 2.f * glm::pi<float>() * u.y;
+		const glm::vec3
+			z = w / std::sqrt(d2),
+			x = glm::normalize(glm::cross(std::abs(z.x) > 0.9f ? glm::vec3{ 0.f, 1.f, 0.f } : glm::vec3{ 1.f, 0.f, 0.f }, z)),
+			y = glm::cross(z, x);
+		ls.direction = glm::normalize(x * (std::cos(phi) * sin_t) + y * (std::sin(phi) * sin_t) + z * cos_t);
+		ls.pdf = pdf / n;
+		return true;
+	}
+	const Triangles& tr = this->triangles;
+	const glm::vec3
+		e1{ tr.e1x[i], tr.e1y[i], tr.e1z[i] },
+		e2{ tr.e2x[i], tr.e2y[i], tr.e2z[i] };
+	const float su = std::sqrt(u.x);
+	glm::vec3 d = glm::vec3{ tr.v0x[i], tr.v0y[i], tr.v0z[i] } + e1 * (1.f - su) + e2 * (u.y * su) - from;
+	const float
+		d2 = glm::dot(d, d),
+		area = 0.5f * glm::length(glm::cross(e1, e2));
+	d /= std::sqrt(d2);
+	const float cos_l = std::abs(glm::dot(glm::vec3{ tr.nx[i], tr.ny[i], tr.nz[i] }, d));
+	if (cos_l < 1e-6f || area <= 0.f) { return false; }
+	ls.direction = d;
+	ls.pdf = d2 / (area * cos_l * n);
+	return true;
+}
+float PrimitiveStore::lightPdf(const glm::vec3& from, const Hit& h) const {
+	if (h.luminance <= 0.f || this->lights.empty()) { return 0.f; }
+	const uint32_t i = h.primitive;
+	const float n = (float)this->lights.size();
+	if (h.type == Primitive_Sphere) {
+		const Spheres& sp = this->spheres;
+		const glm::vec3 w = glm::vec3{ sp.x[i], sp.y[i], sp.z[i] } - from;
+		return conePdf(glm::dot(w, w), sp.radius[i] * sp.radius[i]) / n;
+	}
+	if (h.type == Primitive_Triangle) {
+		const Triangles& tr = this->triangles;
+		const glm::vec3
+			d = h.normal.origin - from,
+			e1{ tr.e1x[i], tr.e1y[i], tr.e1z[i] },
+			e2{ tr.e2x[i], tr.e2y[i], tr.e2z[i] };
+		const float
+			d2 = glm::dot(d, d),
+			area = 0.5f * glm::length(glm::cross(e1, e2)),
+			cos_l = std::abs(glm::dot(glm::vec3{ tr.nx[i], tr.ny[i], tr.nz[i] }, d)) / std::sqrt(d2);
+		return (cos_l < 1e-6f || area <= 0.f) ? 0.f : d2 / (area * cos_l * n);
+	}
+	return 0.f;		// instances aren't sampled
+}
+
+bool PrimitiveStore::intersect(const Ray& r, Hit& h, float t_min, float t_max, TraceStats* stats) const {
+	glm::vec2 uv;
+	glm::vec3 local_normal;
+	if (stats) { stats->rays++; }
+	uint64_t* visited = stats ? &stats->nodes_visited : nullptr;
+
+	h.ptime = t_max;
+	h.type = Primitive_Count;
+	const IntersectKernels& k = IntersectKernels::active();
+	{
+		const uint32_t slot = this->bvh[Primitive_Sphere].activeSlot();
+		const BVH& tree = this->bvh[Primitive_Sphere].get(slot);
+		tree.traverseLeaves(r.origin, r.direction, t_min, h.ptime,
+			[&](uint32_t first, uint32_t count) {
+				if (stats) { stats->primitive_tests += count; }
+				const int32_t l = k.spheres(this->packed_spheres[slot], first, count, r.origin, r.direction, t_min, h.ptime);
+				if (l >= 0) {
+					h.type = Primitive_Sphere;
+					h.primitive = tree.getIndices()[l];
+				}
+			},
+			visited
+		);
+	}
+	{
+		const uint32_t slot = this->bvh[Primitive_Triangle].activeSlot();
+		const BVH& tree = this->bvh[Primitive_Triangle].get(slot);
+		tree.traverseLeaves(r.origin, r.direction, t_min, h.ptime,
+			[&](uint32_t first, uint32_t count) {
+				if (stats) { stats->primitive_tests += count; }
+				const int32_t l = k.triangles(this->packed_triangles[slot], first, count, r.origin, r.direction, t_min, h.ptime, uv);
+				if (l >= 0) {
+					h.type = Primitive_Triangle;
+					h.primitive = tree.getIndices()[l];
+				}
+			},
+			visited
+		);
+	}
+	this->bvh[Primitive_Instance].get().traverse(r.origin, r.direction, t_min, h.ptime,
+		[&](uint32_t i) {
+			if (this->intersectInstance(i, r, t_min, h.ptime, uv, local_normal, stats)) {
+				h.type = Primitive_Instance;
+				h.primitive = i;
+			}
+		},
+		visited
+	);
+	if (h.type == Primitive_Count) { return false; }
+	this->resolve(r, h, uv, local_normal);
+	return true;
+}
+void PrimitiveStore::intersectPacket(const Ray* rays, Hit* hits, uint32_t n, float t_min, float t_max, TraceStats* stats) const {
+	constexpr float MISS = std::numeric_limits<float>::infinity();
+	glm::vec3 inv[MAX_PACKET], local_normal[MAX_PACKET];
+	glm::vec2 uv[MAX_PACKET];
+	float t[MAX_PACKET];
+
+	bool coherent = n <= MAX_PACKET;
+	for (uint32_t j = 0; coherent && j < n; j++) {
+		inv[j] = 1.f / rays[j].direction;
+		t[j] = t_max;
+		hits[j].type = Primitive_Count;
+		coherent = rays[j].origin == rays[0].origin;
+	}
+	if (!coherent || !BVH::packetCompatible(inv, n)) {	// fall back to tracing the rays on their own
+		for (uint32_t j = 0; j < n; j++) {
+			this->intersect(rays[j], hits[j], t_min, t_max, stats);
+		}
+		return;
+	}
+	if (stats) { stats->rays += n; }
+	uint64_t* visited = stats ? &stats->nodes_visited : nullptr;
+
+	const glm::vec3& o = rays[0].origin;
+	const IntersectKernels& k = IntersectKernels::active();
+	{
+		const uint32_t slot = this->bvh[Primitive_Sphere].activeSlot();
+		const BVH& tree = this->bvh[Primitive_Sphere].get(slot);
+		tree.traversePacket(o, inv, n, t_min, t,
+			[&](uint32_t first, uint32_t count, const AABB& leaf) {
+				for (uint32_t j = 0; j < n; j++) {
+					if (leaf.intersect(o, inv[j], t_min, t[j]) == MISS) { continue; }
+					if (stats) { stats->primitive_tests += count; }
+					const int32_t l = k.spheres(this->packed_spheres[slot], first, count, o, rays[j].direction, t_min, t[j]);
+					if (l >= 0) {
+						hits[j].type = Primitive_Sphere;
+						hits[j].primitive = tree.getIndices()[l];
+					}
+				}
+			},
+			visited
+		);
+	}
+	{
+		const uint32_t slot = this->bvh[Primitive_Triangle].activeSlot();
+		const BVH& tree = this->bvh[Primitive_Triangle].get(slot);
+		tree.traversePacket(o, inv, n, t_min, t,
+			[&](uint32_t first, uint32_t count, const AABB& leaf) {
+				for (uint32_t j = 0; j < n; j++) {
+					if (leaf.intersect(o, inv[j], t_min, t[j]) == MISS) { continue; }
+					if (stats) { stats->primitive_tests += count; }
+					const int32_t l = k.triangles(this->packed_triangles[slot], first, count, o, rays[j].direction, t_min, t[j], uv[j]);
+					if (l >= 0) {
+						hits[j].type = Primitive_Triangle;
+						hits[j].primitive = tree.getIndices()[l];
+					}
+				}
+			},
+			visited
+		);
+	}
+	{
+		const BVH& tree = this->bvh[Primitive_Instance].get();
+		tree.traversePacket(o, inv, n, t_min, t,
+			[&](uint32_t first, uint32_t count, const AABB&) {
+				for (uint32_t p = first; p < first + count; p++) {
+					const uint32_t i = tree.getIndices()[p];
+					const AABB& b = this->instances.bounds[i];
+					for (uint32_t j = 0; j < n; j++) {
+						if (b.intersect(o, inv[j], t_min, t[j]) == MISS) { continue; }
+						if (this->intersectInstance(i, rays[j], t_min, t[j], uv[j], local_normal[j], stats)) {
+							hits[j].type = Primitive_Instance;
+							hits[j].primitive = i;
+						}
+					}
+				}
+			},
+			visited
+		);
+	}
+	for (uint32_t j = 0; j < n; j++) {
+		hits[j].ptime = t[j];
+		if (hits[j].type != Primitive_Count) {
+			this->resolve(rays[j], hits[j], uv[j], local_normal[j]);
+		}
+	}
+}
+bool PrimitiveStore::intersectInstance(uint32_t i, const Ray& r, float t_min, float& t, glm::vec2& uv, glm::vec3& local_normal, TraceStats* stats) const {
+	const Instances& in = this->instances;
+	const Ray lr{		// left unnormalized so distances carry over between spaces
+		glm::vec3{ in.inverse[i] * glm::vec4{ r.origin, 1.f } },
+		glm::vec3{ in.inverse[i] * glm::vec4{ r.direction, 0.f } }
+	};
+	Hit local;
+	if (stats) { stats->primitive_tests++; }
+	if (!in.mesh[i]->intersect(lr, local, t_min, t, stats)) { return false; }
+	t = local.ptime;
+	uv = local.uv;
+	local_normal = local.normal.direction;
+	return true;
+}
+void PrimitiveStore::resolve(const Ray& r, Hit& h, const glm::vec2& uv, const glm::vec3& local_normal) const {
+	// only the closest hit gets its surface filled in
+	const Spheres& sp = this->spheres;
+	const Triangles& tr = this->triangles;
+	const uint32_t i = h.primitive;
+	h.normal.origin = r.origin + r.direction * h.ptime;
+	switch (h.type) {
+		case Primitive_Sphere: {
+			h.normal.direction = glm::normalize(h.normal.origin - glm::vec3{ sp.x[i], sp.y[i], sp.z[i] });
+			if (h.reverse_intersect = (glm::dot(h.normal.direction, r.direction) > 0.f)) {
+				h.normal.direction *= -1;
+			}
+			h.uv = glm::vec2{ -1.f };	// computed on demand in albedo()
+			break;
+		}
+		case Primitive_Triangle: {
+			const glm::vec3 n{ tr.nx[i], tr.ny[i], tr.nz[i] };
+			h.normal.direction = n * -sgn(glm::dot(n, r.direction));
+			h.reverse_intersect = false;
+			h.uv = tr.t0[i] + tr.te1[i] * uv.x + tr.te2[i] * uv.y;
+			break;
+		}
+		default: {
+			const glm::vec3 n = glm::normalize(this->instances.normal_matrix[i] * local_normal);
+			h.normal.direction = n * -sgn(glm::dot(n, r.direction));
+			h.reverse_intersect = false;
+			h.uv = uv;
+		}
+	}
+	const Surfaces& s = this->surfaces(h.type);
+	h.material = s.material[i];
+	h.texture = s.texture[i];
+	h.luminance = s.luminance[i];
+}
+glm::vec3 PrimitiveStore::albedo(Hit& h) const {
+	const Texture* t = this->textures[h.texture];
+	if (!t) {
+		return glm::vec3{ 0.f };
+	}
+	if (h.type == Primitive_Sphere && h.uv == glm::vec2{ -1.f }) {
+		h.uv = glm::vec2{
+			(atan2f(-h.normal.direction.z, h.normal.direction.x) + glm::pi<float>()) / glm::two_pi<float>(),
+			acosf(-h.normal.direction.y) / glm::pi<float>()
+		};
+	}
+	return t->albedo(h.uv);
+}
 
 
 const Interactable* Scene::interacts(const Ray& r, Hit& h, float tmin, float tmax) const {
-	Hit temp;
-	const Interactable* ret = nullptr;
-	h.ptime = tmax;
-	for (const std::shared_ptr<Interactable>& obj : this->objects) {
-		if (const Interactable* i = obj->interacts(r, temp, tmin, h.ptime)) {
-			h.reverse_intersect = temp.reverse_intersect;
-			h.ptime = temp.ptime;
-			h.normal = temp.normal;
-			ret = i;
+	return this->primitives.intersect(r, h, tmin, tmax) ? this->objects[this->primitives.owner(h)].get() : nullptr;
+}
+void Scene::rebuildBVH() {
+	this->primitives.build(this->objects);
+}
+void Scene::refitBVH(size_t i) {
+	if (!this->primitives.update((uint32_t)i, *this->objects[i])) {
+		this->rebuildBVH();
+	}
+}
+bool Scene::applyEdits() {
+	this->primitives.poll();	// the same geometry, so it doesn't count as a change
+	bool changed = this->rebuild_pending || !this->edited.empty() || this->sky_edited;
+	if (this->rebuild_pending) {
+		this->rebuildBVH();
+	} else {
+		for (uint32_t i : this->edited) {
+			this->refitBVH(i);
 		}
 	}
-	return ret;
+	this->edited.clear();
+	this->rebuild_pending = false;
+	if (this->sky_edited) {
+		this->sky_color = this->sky_edit;
+		this->sky_edited = false;
+	}
+	for (uint32_t t = 0; t < Primitive_Count; t++) {
+		const BufferedBVH& b = this->primitives.getBVH((PrimitiveType)t);
+		this->bvh_status[t] = BVHStatus{ b.get().getStats(), b.get().getPrimitiveBounds().size(), b.building() };
+	}
+	return changed;
 }
+#ifndef RT_HEADLESS
 bool Scene::invokeGuiOptions() {
-	bool r = ImGui::ColorEdit3("Sky Color", glm::value_ptr(this->sky_color));
+	if (!this->sky_edited) {
+		this->sky_edit = this->sky_color;
+	}
+	bool r = ImGui::ColorEdit3("Sky Color", glm::value_ptr(this->sky_edit));
+	this->sky_edited |= r;
+	static const char* const names[Primitive_Count] = { "Spheres", "Triangles", "Instances" };
+	for (uint32_t t = 0; t < Primitive_Count; t++) {
+		const BVHStatus& b = this->bvh_status[t];
+		ImGui::Text("%s: %zu, BVH %u nodes (%u leaves), depth %u, SAH cost %.2f, built in %.3f ms",
+			names[t], b.primitives, b.stats.nodes, b.stats.leaves, b.stats.depth, b.stats.sah_cost, b.stats.build_ms);
+		ImGui::Text("    Refits: %u (%+.1f%% SAH cost)%s",
+			b.stats.refits, (b.stats.degradation() - 1.f) * 100.f, b.building ? " -- rebuilding..." : "");
+	}
+	ImGui::Separator();
 	size_t i = 0;
 	for (std::shared_ptr<Interactable>& obj : this->objects) {
 		ImGui::PushID(i);
 		if (ImGui::CollapsingHeader(("Obj " + std::to_string(i)).c_str())) {
-			r |= obj->invokeGuiOptions();
+			if (obj->invokeGuiOptions()) {
+				if (std::find(this->edited.begin(), this->edited.end(), (uint32_t)i) == this->edited.end()) {
+					this->edited.push_back((uint32_t)i);
+				}
+				r = true;
+			}
 		}
 		ImGui::PopID();
 		i++;
 	}
+	bool added = false;
 	if (ImGui::Button("Add Sphere")) {
 		this->objects.emplace_back(std::make_shared<Sphere>());
-		r = true;
+		added = true;
 	} ImGui::SameLine();
 	if (ImGui::Button("Add Triangle")) {
 		this->objects.emplace_back(std::make_shared<Triangle>(
 			glm::vec3{ 0, 0, 0 }, glm::vec3{ 0, 1, 0 }, glm::vec3{ 1, 1, 0 }
 		));
-		r = true;
+		added = true;
 	} ImGui::SameLine();
 	if (ImGui::Button("Add Quad")) {
 		this->objects.emplace_back(std::make_shared<Quad>(
 			glm::vec3{ 0, 0, 0 }, glm::vec3{ 0, 1, 0 }, glm::vec3{ 1, 1, 0 }, glm::vec3{ 1, 0, 0 }
 		));
-		r = true;
+		added = true;
+	} ImGui::SameLine();
+	if (ImGui::Button("Add Cube Instance")) {
+		this->objects.emplace_back(std::make_shared<Instance>(Mesh::unitCube()));
+		added = true;
 	}
-	return r;
+	this->rebuild_pending |= added;
+	return r || added;
 }
 
 bool MaterialManager::invokeGui() {
@@ -446,4 +1292,5 @@ bool TextureManager::invokeGui() {
 		r = true;
 	}
 	return r;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
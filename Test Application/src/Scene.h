@@ -6,7 +6,10 @@
 
 #include <glm/glm.hpp>
 #include <stb_image.h>
-#include <Walnut/Random.h>
+
+#include "BVH.h"
+#include "Kernels.h"
+#include "Rng.h"
 
 
 inline static float sgn(float v) { return (int)(v > 0) - (int)(v < 0); }
@@ -28,6 +31,13 @@ inline static t clamp(t n, t h, t l)
 	{ return n >= h ? h : n <= l ? l : n; }
 
 
+enum PrimitiveType : uint32_t {
+	Primitive_Sphere = 0,
+	Primitive_Triangle,
+	Primitive_Instance,
+	Primitive_Count		// also marks a hit that did not come from the primitive store
+};
+
 struct Ray {
 	glm::vec3 origin{0.f};
 	glm::vec3 direction{0.f};
@@ -37,7 +47,29 @@ struct Hit {
 	float ptime{0.f};		// time along source ray
 	Ray normal{};			// normal with origin at the hit point
 	glm::vec2 uv{ -1.f };
+
+	uint32_t
+		type{ Primitive_Count },	// filled in by the primitive store
+		primitive{ 0 },
+		material{ 0 },	// IDs into the store's tables -- 0 is "none"
+		texture{ 0 };
+	float luminance{ 0.f };
 };
+struct TraceStats {		// optionally filled in by intersection queries -- not shared between threads
+	uint64_t
+		rays{ 0 },
+		primitive_tests{ 0 },	// spheres, triangles and instance meshes entered
+		nodes_visited{ 0 };		// across every BVH level
+
+	inline TraceStats& operator+=(const TraceStats& s) {
+		this->rays += s.rays;
+		this->primitive_tests += s.primitive_tests;
+		this->nodes_visited += s.nodes_visited;
+		return *this;
+	}
+};
+
+class PrimitiveStore;
 
 
 class Interactable {
@@ -49,17 +81,38 @@ public:
 	) const = 0;
 	virtual bool redirect(
 		const Ray& source,
-		const Hit& interaction, Ray& redirected
+		const Hit& interaction, Ray& redirected,
+		Rng& rng
 	) const = 0;
+	virtual AABB bounds() const = 0;	// world-space bounding box
+	inline virtual void compile(PrimitiveStore&) const {}	// writes the object's primitives into the store that the render path traverses
 
 	inline virtual float emmission(Hit& hit) const { return 0.f; }
 	inline virtual glm::vec3 albedo(Hit& hit) const { return glm::vec3{ 0.5f }; }
 
 	inline virtual bool invokeGuiOptions() { return false; }	// should return true if anything was updated
 };
+enum LobeType : uint32_t {
+	Lobe_Diffuse = 0,	// cosine distributed -- lights are sampled directly for these
+	Lobe_Glossy,		// GGX microfacet normals
+	Lobe_Specular		// a single direction
+};
+struct Lobe {	// what a redirected direction was drawn from, so that the integrator can weight it
+	uint32_t type{ Lobe_Specular };
+	/* Solid angle density of the direction, conditional on the lobe and, for a glossy dielectric, on whether it reflected or
+	* refracted -- neither selection probability is included, so weighting glossy lobes needs those multiplied in. 0 for specular. */
+	float pdf{ 0.f };
+};
+
 class Material {
 public:
-	virtual bool redirect(const Ray& source, const Hit& interaction, Ray& redirected) const = 0;
+	virtual bool redirect(const Ray& source, const Hit& interaction, Ray& redirected, Rng&) const = 0;
+	// same as above, also reporting the lobe that the direction was drawn from
+	inline virtual bool redirect(const Ray& source, const Hit& interaction, Ray& redirected, Rng& rng, Lobe& lobe) const
+		{ lobe = Lobe{}; return this->redirect(source, interaction, redirected, rng); }
+	// density that a lobe of redirect() has for 'direction' -- for the diffuse lobe, the BSDF times cosine is assumed to be albedo * pdf
+	inline virtual float pdf(const Ray&, const Hit&, const glm::vec3&, uint32_t) const
+		{ return 0.f; }
 	inline virtual bool invokeGuiOptions() { return false; }
 };
 class Texture {
@@ -85,12 +138,18 @@ public:
 
 	float roughness, glossiness, transparency, refraction_index;
 
-	virtual bool redirect(const Ray& source, const Hit& interaction, Ray& redirected) const override;
+	inline virtual bool redirect(const Ray& source, const Hit& interaction, Ray& redirected, Rng& rng) const override
+		{ Lobe l; return this->redirect(source, interaction, redirected, rng, l); }
+	virtual bool redirect(const Ray& source, const Hit& interaction, Ray& redirected, Rng&, Lobe&) const override;
+	virtual float pdf(const Ray& source, const Hit& interaction, const glm::vec3& direction, uint32_t lobe) const override;
+#ifndef RT_HEADLESS
 	virtual bool invokeGuiOptions() override;
+#endif
 
-	static bool diffuse(const Ray& normal, Ray& redirect);
-	static bool reflect(const Ray& source, const Hit& hit, Ray& redirect, float gloss = 0.f);
-	static bool refract(const Ray& source, const Hit& hit, float refr_index, Ray& redirect, float gloss = 0.f);
+	// gloss is the GGX alpha of the microfacet normals that reflect() and refract() scatter about (0 for a perfect mirror)
+	static bool diffuse(const Ray& normal, Ray& redirect, Rng&);
+	static bool reflect(const Ray& source, const Hit& hit, Ray& redirect, Rng&, float gloss = 0.f);
+	static bool refract(const Ray& source, const Hit& hit, float refr_index, Ray& redirect, Rng&, float gloss = 0.f);
 
 };
 class StaticColor : public Texture {
@@ -102,9 +161,16 @@ public:
 	glm::vec3 color;
 
 	inline virtual glm::vec3 albedo(glm::vec2) const override { return this->color; }
+#ifndef RT_HEADLESS
 	virtual bool invokeGuiOptions() override;
+#endif
 
 };
+// inline so that they are always initialized before scenes defined in headers that include this one (ex. Objects.h)
+inline const std::unique_ptr<Material>
+	PhysicalBase::DEFAULT{ std::make_unique<PhysicalBase>() };
+inline const std::unique_ptr<Texture>
+	StaticColor::DEFAULT{ std::make_unique<StaticColor>() };
 class ImageTexture : public Texture {
 public:
 	inline ImageTexture() :
@@ -118,7 +184,9 @@ public:
 		{ if(this->data) { free(this->data); } }
 
 	virtual glm::vec3 albedo(glm::vec2) const override;
+#ifndef RT_HEADLESS
 	virtual bool invokeGuiOptions() override;
+#endif
 
 	uint8_t* data, pixel_bytes{ 3U };
 	uint32_t width, height;
@@ -146,13 +214,17 @@ public:
 
 	virtual const Interactable* interacts(
 		const Ray& source, Hit& hit, float t_min = 1e-5f, float t_max = std::numeric_limits<float>::infinity()) const override;
+	virtual AABB bounds() const override;
+	virtual void compile(PrimitiveStore&) const override;
 	virtual glm::vec3 albedo(Hit& hit) const override;
-	inline virtual bool redirect(const Ray& source, const Hit& hit, Ray& redirected) const override
-		{ return this->mat ? this->mat->redirect(source, hit, redirected) : false; }
+	inline virtual bool redirect(const Ray& source, const Hit& hit, Ray& redirected, Rng& rng) const override
+		{ return this->mat ? this->mat->redirect(source, hit, redirected, rng) : false; }
 	inline virtual float emmission(Hit& hit) const override
 		{ return this->luminance; }
 
+#ifndef RT_HEADLESS
 	virtual bool invokeGuiOptions() override;
+#endif
 
 
 };
@@ -176,15 +248,24 @@ public:
 	Texture* tex;
 
 	void move(glm::vec3);
+
+	// Möller-Trumbore -- outputs the distance along the ray and the barycentric coordinates of the hit
+	static bool intersect(
+		const glm::vec3& p1, const glm::vec3& e1, const glm::vec3& e2,
+		const Ray& source, float t_min, float t_max, float& t, glm::vec2& uv);
 	
 	virtual const Interactable* interacts(const Ray& source, Hit& hit, float t_min = 1e-5f, float t_max = std::numeric_limits<float>::infinity()) const override;
+	virtual AABB bounds() const override;
+	virtual void compile(PrimitiveStore&) const override;
 	virtual glm::vec3 albedo(Hit& hit) const override;
-	inline virtual bool redirect(const Ray& source, const Hit& hit, Ray& redirected) const override
-		{ return this->mat ? this->mat->redirect(source, hit, redirected) : false; }
+	inline virtual bool redirect(const Ray& source, const Hit& hit, Ray& redirected, Rng& rng) const override
+		{ return this->mat ? this->mat->redirect(source, hit, redirected, rng) : false; }
 	inline virtual float emmission(Hit& hit) const override
 		{ return this->luminance; }
 	
+#ifndef RT_HEADLESS
 	virtual bool invokeGuiOptions() override;
+#endif
 
 
 };
@@ -207,12 +288,101 @@ public:
 	
 	virtual const Interactable* interacts(
 		const Ray& source, Hit& hit, float t_min = 1e-5f, float t_max = std::numeric_limits<float>::infinity()) const override;
+	virtual AABB bounds() const override;
+	virtual void compile(PrimitiveStore&) const override;
 	virtual glm::vec3 albedo(Hit& hit) const override;
-	inline virtual bool redirect(const Ray& source, const Hit& hit, Ray& redirected) const override
-		{ return this->h1.mat ? this->h1.mat->redirect(source, hit, redirected) : false; }
+	inline virtual bool redirect(const Ray& source, const Hit& hit, Ray& redirected, Rng& rng) const override
+		{ return this->h1.mat ? this->h1.mat->redirect(source, hit, redirected, rng) : false; }
 	inline virtual float emmission(Hit& hit) const override
 		{ return this->h1.luminance; }
+#ifndef RT_HEADLESS
 	virtual bool invokeGuiOptions() override;
+#endif
+
+
+};
+
+/* Shared, immutable triangle geometry in object space with its own BVH (the bottom level of the scene's
+* acceleration structure). Placed in the scene through any number of Instance's. */
+class Mesh {
+public:
+	Mesh(
+		const std::vector<glm::vec3>& vertices,
+		const std::vector<uint32_t>& indices,	// 3 per triangle
+		const std::vector<glm::vec2>& texcoords = {},	// per vertex -- barycentrics are used when empty
+		Material* m = PhysicalBase::DEFAULT.get(),
+		Texture* t = StaticColor::DEFAULT.get()
+	);
+
+	static const std::shared_ptr<const Mesh>& unitQuad();	// [0, 1] on x and y, facing +z
+	static const std::shared_ptr<const Mesh>& unitCube();	// [-0.5, 0.5] on every axis
+
+	Material* mat;	// defaults for instances that don't override them
+	Texture* tex;
+
+	bool intersect(const Ray& local, Hit& hit, float t_min, float t_max, TraceStats* = nullptr) const;	// ray in object space -- the hit normal is not oriented
+	inline AABB bounds() const { return this->bvh.bounds(); }
+	inline size_t size() const { return this->normal.size(); }
+
+protected:
+	PackedTriangles packed;		// in leaf order
+	std::vector<glm::vec3> normal;	// per triangle
+	std::vector<glm::vec2> t0, te1, te2;		// texcoord origin and edges per triangle, if provided
+	BVH bvh;
+
+
+};
+class Instance : public Interactable {
+public:
+	Instance(
+		std::shared_ptr<const Mesh> mesh,
+		glm::vec3 p = glm::vec3{ 0.f },
+		glm::vec3 r = glm::vec3{ 0.f },
+		glm::vec3 s = glm::vec3{ 1.f },
+		Material* m = nullptr,
+		Texture* t = nullptr,
+		float l = 0.f,
+		const glm::mat4& base = glm::mat4{ 1.f }
+	);
+
+	static std::shared_ptr<Instance> fromQuad(	// places Mesh::unitQuad() on the parallelogram at p with adjacent corners a and b
+		glm::vec3 p, glm::vec3 a, glm::vec3 b,
+		Material* m = nullptr,
+		Texture* t = nullptr,
+		float l = 0.f
+	);
+
+	std::shared_ptr<const Mesh> mesh;
+	glm::vec3
+		position,
+		rotation,	// euler angles in degrees
+		scale;
+	glm::mat4 base;		// applied to the mesh before scale, rotation and position
+	float luminance;
+	Material* mat;	// override the mesh's defaults when set
+	Texture* tex;
+
+	void updateTransform();	// must be called after any of the above transform components change
+	inline Material* material() const { return this->mat ? this->mat : this->mesh->mat; }
+	inline Texture* texture() const { return this->tex ? this->tex : this->mesh->tex; }
+
+	virtual const Interactable* interacts(
+		const Ray& source, Hit& hit, float t_min = 1e-5f, float t_max = std::numeric_limits<float>::infinity()) const override;
+	virtual AABB bounds() const override;
+	virtual void compile(PrimitiveStore&) const override;
+	virtual glm::vec3 albedo(Hit& hit) const override;
+	inline virtual bool redirect(const Ray& source, const Hit& hit, Ray& redirected, Rng& rng) const override
+		{ return this->material() ? this->material()->redirect(source, hit, redirected, rng) : false; }
+	inline virtual float emmission(Hit& hit) const override
+		{ return this->luminance; }
+
+#ifndef RT_HEADLESS
+	virtual bool invokeGuiOptions() override;
+#endif
+
+private:
+	glm::mat4 transform, inverse;
+	glm::mat3 normal_matrix;
 
 
 };
@@ -224,22 +394,203 @@ public:
 */
 
 
+/* Flat structure-of-arrays copy of the scene's geometry that the render path traverses in place of the object list.
+* Primitives are addressed by index within their type, each type has its own BVH, and materials/textures are
+* referenced by ID into the tables below (0 is "none"). Objects write themselves in through Interactable::compile(). */
+class PrimitiveStore {
+public:
+	PrimitiveStore() = default;
+
+	struct Surfaces {	// per primitive, for every type
+		std::vector<AABB> bounds;
+		std::vector<uint32_t> material, texture, object;
+		std::vector<float> luminance;
+
+		inline size_t size() const { return this->bounds.size(); }
+		void resize(size_t);
+	};
+	struct Spheres : Surfaces {
+		std::vector<float> x, y, z, radius;
+
+		void resize(size_t);
+	};
+	struct Triangles : Surfaces {
+		std::vector<float>
+			v0x, v0y, v0z,
+			e1x, e1y, e1z,
+			e2x, e2y, e2z,
+			nx, ny, nz;
+		std::vector<glm::vec2> t0, te1, te2;	// texcoord origin and edges
+
+		void resize(size_t);
+	};
+	struct Instances : Surfaces {
+		std::vector<const Mesh*> mesh;
+		std::vector<glm::mat4> inverse;
+		std::vector<glm::mat3> normal_matrix;
+
+		void resize(size_t);
+	};
+
+	void build(const std::vector<std::shared_ptr<Interactable>>& objects);	// recompiles everything and rebuilds each BVH (with leaves sized for the active intersection kernels)
+	bool update(uint32_t object, const Interactable&);	// rewrites an object's primitives in place and refits -- returns false if it now emits a different set of primitives
+	bool poll();	// lands any finished background rebuilds
+
+	// called from Interactable::compile()
+	void addSphere(const glm::vec3& center, float radius, Material*, Texture*, float luminance);
+	void addTriangle(
+		const glm::vec3& a, const glm::vec3& b, const glm::vec3& c,
+		Material*, Texture*, float luminance,
+		const glm::vec2& ta = glm::vec2{ 0.f, 0.f },
+		const glm::vec2& tb = glm::vec2{ 1.f, 0.f },
+		const glm::vec2& tc = glm::vec2{ 0.f, 1.f });
+	void addInstance(const Mesh*, const glm::mat4& inverse, const AABB& bounds, Material*, Texture*, float luminance);
+
+	bool intersect(const Ray& source, Hit& hit, float t_min, float t_max, TraceStats* = nullptr) const;
+	// traces up to MAX_PACKET rays sharing an origin together -- misses are left with a type of Primitive_Count
+	void intersectPacket(const Ray* sources, Hit* hits, uint32_t count, float t_min, float t_max, TraceStats* = nullptr) const;
+	glm::vec3 albedo(Hit& hit) const;
+	inline bool redirect(const Ray& source, const Hit& hit, Ray& redirected, Rng& rng, Lobe& lobe) const {
+		const Material* m = this->materials[hit.material];
+		lobe = Lobe{};
+		return m ? m->redirect(source, hit, redirected, rng, lobe) : false;
+	}
+	inline float pdf(const Ray& source, const Hit& hit, const glm::vec3& direction, uint32_t lobe) const {
+		const Material* m = this->materials[hit.material];
+		return m ? m->pdf(source, hit, direction, lobe) : 0.f;
+	}
+
+	struct LightSample {
+		glm::vec3 direction;	// normalized, from the shaded point
+		float pdf;		// over solid angle, including the choice of light
+		uint32_t type, primitive;	// what a ray along 'direction' should hit first if the light is unoccluded
+	};
+	/* Emissive spheres and triangles make up the light list (instances are left to be found by bounces). A light is
+	* picked uniformly, then a direction towards it -- within the subtended cone for spheres, by area for triangles. */
+	bool sampleLight(const glm::vec3& from, Rng&, LightSample&) const;
+	float lightPdf(const glm::vec3& from, const Hit& hit) const;	// density sampleLight() has for the hit point, 0 if it isn't on a listed light
+	inline uint32_t lightCount() const { return (uint32_t)this->lights.size(); }
+	inline uint32_t owner(const Hit& h) const { return this->surfaces(h.type).object[h.primitive]; }
+
+	inline const Spheres& getSpheres() const { return this->spheres; }
+	inline const Triangles& getTriangles() const { return this->triangles; }
+	inline const Instances& getInstances() const { return this->instances; }
+	inline const BufferedBVH& getBVH(PrimitiveType t) const { return this->bvh[t]; }
+	inline uint32_t materialCount() const { return (uint32_t)this->materials.size(); }	// including the null ID
+	inline bool building() const
+		{ return this->bvh[Primitive_Sphere].building() || this->bvh[Primitive_Triangle].building() || this->bvh[Primitive_Instance].building(); }
+
+	static constexpr float BVH_REBUILD_THRESHOLD = 1.25f;	// SAH cost growth (relative to the last build) that triggers a background rebuild
+	static constexpr uint32_t MAX_PACKET = 64;
+
+protected:
+	inline const Surfaces& surfaces(uint32_t t) const {
+		return t == Primitive_Sphere ? (const Surfaces&)this->spheres :
+			t == Primitive_Triangle ? (const Surfaces&)this->triangles : (const Surfaces&)this->instances;
+	}
+	uint32_t slot(PrimitiveType, Material*, Texture*, float luminance, const AABB& bounds);	// next index for the object being compiled
+	void pack(PrimitiveType, uint32_t slot);	// lays out a type's geometry in the leaf order of the BVH in 'slot'
+	void packPrimitive(PrimitiveType, uint32_t slot, uint32_t primitive);
+	bool intersectInstance(uint32_t instance, const Ray&, float t_min, float& t, glm::vec2& uv, glm::vec3& local_normal, TraceStats* = nullptr) const;
+	void resolve(const Ray&, Hit&, const glm::vec2& uv, const glm::vec3& local_normal) const;	// fills in the surface of the closest hit
+	uint32_t materialID(Material*);
+	uint32_t textureID(Texture*);
+	void collectLights();
+
+	Spheres spheres;
+	Triangles triangles;
+	Instances instances;
+	BufferedBVH bvh[Primitive_Count];
+	PackedSpheres packed_spheres[2];		// one per BVH slot
+	PackedTriangles packed_triangles[2];
+
+	std::vector<Material*> materials{ nullptr };
+	std::vector<Texture*> textures{ nullptr };
+
+	struct Range {
+		uint32_t
+			type{ Primitive_Count },
+			first{ 0 },
+			count{ 0 };
+	};
+	std::vector<Range> ranges;	// per object
+	std::vector<std::pair<uint32_t, uint32_t>> lights;	// type and index of every emissive sphere and triangle
+	uint32_t
+		compiling{ 0 },		// object currently being compiled
+		written{ 0 };		// primitives it has emitted so far
+	bool updating{ false };
+
+
+};
+
+
 class Scene : public Interactable {
 public:
-	inline Scene(std::initializer_list<std::shared_ptr<Interactable>> objs) : objects(objs) {}
+	inline Scene(std::initializer_list<std::shared_ptr<Interactable>> objs) : objects(objs)
+		{ this->rebuildBVH(); }
+	inline Scene(std::vector<std::shared_ptr<Interactable>> objs) : objects(std::move(objs))
+		{ this->rebuildBVH(); }
 
 	glm::vec3 sky_color{0.2f};
 
-	virtual const Interactable* interacts(
+	virtual const Interactable* interacts(	// returns the owning object of the primitive that was hit
 		const Ray& source, Hit& hit, float t_min = 1e-5f, float t_max = std::numeric_limits<float>::infinity()) const override;
-	inline virtual bool redirect(const Ray& source, const Hit& interaction, Ray& redirected) const override
+	inline virtual AABB bounds() const override {
+		AABB b;
+		for (uint32_t t = 0; t < Primitive_Count; t++) {
+			b.extend(this->primitives.getBVH((PrimitiveType)t).get().bounds());
+		}
+		return b;
+	}
+	inline virtual bool redirect(const Ray& source, const Hit& interaction, Ray& redirected, Rng&) const override
 		{ return false; }
 	inline virtual glm::vec3 albedo(Hit& hit) const
 		{ return this->sky_color; }
+#ifndef RT_HEADLESS
 	virtual bool invokeGuiOptions() override;
+#endif
+
+	// render path -- no per-object dispatch
+	inline bool intersect(const Ray& source, Hit& hit, float t_min = 1e-5f, float t_max = std::numeric_limits<float>::infinity(), TraceStats* stats = nullptr) const
+		{ return this->primitives.intersect(source, hit, t_min, t_max, stats); }
+	inline glm::vec3 surfaceAlbedo(Hit& hit) const
+		{ return this->primitives.albedo(hit); }
+	inline void intersectPacket(const Ray* sources, Hit* hits, uint32_t count, float t_min = 1e-5f, float t_max = std::numeric_limits<float>::infinity(), TraceStats* stats = nullptr) const
+		{ this->primitives.intersectPacket(sources, hits, count, t_min, t_max, stats); }
+	inline bool surfaceRedirect(const Ray& source, const Hit& hit, Ray& redirected, Rng& rng) const
+		{ Lobe l; return this->primitives.redirect(source, hit, redirected, rng, l); }
+	inline bool surfaceRedirect(const Ray& source, const Hit& hit, Ray& redirected, Rng& rng, Lobe& lobe) const
+		{ return this->primitives.redirect(source, hit, redirected, rng, lobe); }
+	inline float surfacePdf(const Ray& source, const Hit& hit, const glm::vec3& direction, uint32_t lobe) const
+		{ return this->primitives.pdf(source, hit, direction, lobe); }
+	inline bool sampleLight(const glm::vec3& from, Rng& rng, PrimitiveStore::LightSample& sample) const
+		{ return this->primitives.sampleLight(from, rng, sample); }
+	inline float lightPdf(const glm::vec3& from, const Hit& hit) const
+		{ return this->primitives.lightPdf(from, hit); }
+
+	void rebuildBVH();	// must be called after objects are added or removed
+	void refitBVH(size_t object);	// must be called after an object is edited -- schedules a background rebuild once the tree degrades
+	/* The gui only edits the objects and queues what changed. This compiles the queued edits into the primitive store and
+	* lands finished background rebuilds, so it has to be called from the render thread between frames -- and never at the
+	* same time as invokeGuiOptions(). Returns true if anything that renders has changed. */
+	bool applyEdits();
+
+	inline const PrimitiveStore& getPrimitives() const { return this->primitives; }
 
 private:
-	std::vector<std::shared_ptr<Interactable>> objects;
+	std::vector<std::shared_ptr<Interactable>> objects;		// editable view over 'primitives'
+	PrimitiveStore primitives;
+
+	// queued by the gui for applyEdits()
+	std::vector<uint32_t> edited;	// objects to refit
+	bool rebuild_pending{ false };	// objects were added
+	bool sky_edited{ false };
+	glm::vec3 sky_edit{ 0.2f };
+	struct BVHStatus {		// copied out of the store by applyEdits(), for the gui to show
+		BVH::BuildStats stats;
+		size_t primitives{ 0 };
+		bool building{ false };
+	} bvh_status[Primitive_Count];
 
 };
 
@@ -252,7 +603,9 @@ public:
 	template<typename Mat_t>
 	void addExisting(std::unique_ptr<Mat_t>&&);*/
 
+#ifndef RT_HEADLESS
 	bool invokeGui();	// returns if any settings were updated --> this does not necessarily correlate to if anything within the scene changed
+#endif
 
 private:
 	std::vector<std::unique_ptr<Material>> materials;
@@ -262,7 +615,9 @@ class TextureManager {
 public:
 	TextureManager() = default;
 
+#ifndef RT_HEADLESS
 	bool invokeGui();	// returns if any settings were updated --> this does not necessarily correlate to if anything within the scene changed
+#endif
 
 private:
 	std::vector<std::unique_ptr<Texture>> textures;
@@ -0,0 +1,163 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+static void pinThread(std::thread& t, uint32_t core) {
+#ifdef _WIN32
+	SetThreadAffinityMask((HANDLE)t.native_handle(), (DWORD_PTR)1 << (core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core % CPU_SETSIZE, &set);
+	pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+#else
+	(void)t; (void)core;	// no affinity control -- the threads are left to the OS
+#endif
+}
+
+
+ThreadPool::ThreadPool(uint32_t threads, bool pin) : pin(pin) {
+	this->spawn(threads ? threads : hardwareThreads());
+}
+ThreadPool::~ThreadPool() {
+	this->join();
+}
+
+uint32_t ThreadPool::hardwareThreads() {
+	return std::max(std::thread::hardware_concurrency(), 1U);
+}
+
+void ThreadPool::resize(uint32_t threads, bool pin) {
+	if (!threads) {
+		threads = hardwareThreads();
+	}
+	if (threads == this->size() && pin == this->pin) {
+		return;
+	}
+	this->join();
+	this->pin = pin;
+	this->spawn(threads);
+}
+
+void ThreadPool::spawn(uint32_t threads) {
+	this->stop = false;
+	this->workers.reserve(threads - 1);
+	for (uint32_t i = 0; i + 1 < threads; i++) {
+		this->workers.emplace_back(std::make_unique<Worker>());		// every deque has to exist before anyone tries to steal from it
+	}
+	const uint32_t cores = hardwareThreads();
+	for (uint32_t i = 0; i + 1 < threads; i++) {
+		this->workers[i]->thread = std::thread(&ThreadPool::work, this, i, this->generation);
+		if (this->pin) {
+			pinThread(this->workers[i]->thread, (i + 1) % cores);		// core 0 is left to the calling thread
+		}
+	}
+}
+void ThreadPool::join() {
+	{
+		std::lock_guard<std::mutex> l(this->state_lock);
+		this->stop = true;
+	}
+	this->wake.notify_all();
+	for (auto& w : this->workers) {
+		if (w->thread.joinable()) {
+			w->thread.join();
+		}
+	}
+	this->workers.clear();
+}
+
+void ThreadPool::run(uint32_t n, const std::function<void(uint32_t)>& f) {
+	this->run(n, [&f](uint32_t task, uint32_t) { f(task); });
+}
+void ThreadPool::run(uint32_t n, const std::function<void(uint32_t, uint32_t)>& f) {
+	if (!n) {
+		return;
+	}
+	if (this->workers.empty()) {
+		for (uint32_t i = 0; i < n; i++) {
+			f(i, 0);
+		}
+		return;
+	}
+	this->job = &f;		// published to the workers through the deque locks below
+	this->remaining = n;
+	const uint32_t
+		threads = (uint32_t)this->workers.size(),
+		block = (n + threads - 1) / threads;
+	for (uint32_t w = 0; w < threads; w++) {
+		std::lock_guard<std::mutex> l(this->workers[w]->lock);
+		for (uint32_t t = w * block; t < std::min(n, (w + 1) * block); t++) {
+			this->workers[w]->tasks.push_back(t);
+		}
+	}
+	{
+		std::lock_guard<std::mutex> l(this->state_lock);
+		this->generation++;
+	}
+	this->wake.notify_all();
+
+	uint32_t task;
+	while (this->next(threads, task)) {		// the caller has no deque of its own, so it only steals
+		this->execute(task, threads);
+	}
+	std::unique_lock<std::mutex> l(this->state_lock);
+	this->finished.wait(l, [this]() { return this->remaining == 0; });
+}
+
+void ThreadPool::work(uint32_t id, uint64_t seen) {
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> l(this->state_lock);
+			this->wake.wait(l, [this, seen]() { return this->stop || this->generation != seen; });
+			if (this->stop) {
+				return;
+			}
+			seen = this->generation;
+		}
+		uint32_t task;
+		while (this->next(id, task)) {
+			this->execute(task, id);
+		}
+	}
+}
+bool ThreadPool::next(uint32_t id, uint32_t& task) {
+	const uint32_t threads = (uint32_t)this->workers.size();
+	if (id < threads) {
+		Worker& w = *this->workers[id];
+		std::lock_guard<std::mutex> l(w.lock);
+		if (!w.tasks.empty()) {
+			task = w.tasks.front();		// own tasks in order...
+			w.tasks.pop_front();
+			return true;
+		}
+	}
+	for (uint32_t k = 1; k <= threads; k++) {
+		Worker& v = *this->workers[(id + k) % threads];
+		std::lock_guard<std::mutex> l(v.lock);
+		if (!v.tasks.empty()) {
+			task = v.tasks.back();		// ...stolen ones from the far end, away from the owner
+			v.tasks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+void ThreadPool::execute(uint32_t task, uint32_t thread) {
+	(*this->job)(task, thread);
+	if (--this->remaining == 0) {
+		std::lock_guard<std::mutex> l(this->state_lock);
+		this->finished.notify_all();
+	}
+}
\ No newline at end of file
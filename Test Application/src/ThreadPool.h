@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+
+/* Fixed set of worker threads that each own a deque of task indices. A job's indices are handed out in contiguous
+* blocks (so neighboring tiles tend to stay on one core), and a worker that runs out pops from the back of another
+* worker's deque -- expensive tasks end up spread across every thread instead of holding up whoever got them. */
+class ThreadPool {
+public:
+	ThreadPool(uint32_t threads = 0, bool pin = false);	// thread count includes the caller of run() -- 0 uses every hardware thread
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void resize(uint32_t threads, bool pin);	// respawns the workers if anything changed -- not safe to call during run()
+	inline uint32_t size() const { return (uint32_t)this->workers.size() + 1; }
+	inline bool pinned() const { return this->pin; }
+
+	void run(uint32_t n, const std::function<void(uint32_t)>& f);	// calls f(i) for every i in [0, n) and blocks until all have finished (the calling thread helps)
+	void run(uint32_t n, const std::function<void(uint32_t task, uint32_t thread)>& f);	// same, also passing the index of the executing thread in [0, size()) -- the caller is always the last
+
+	static uint32_t hardwareThreads();
+
+protected:
+	struct Worker {
+		std::mutex lock;
+		std::deque<uint32_t> tasks;
+		std::thread thread;
+	};
+
+	void spawn(uint32_t threads);
+	void join();
+	void work(uint32_t id, uint64_t seen);
+	bool next(uint32_t id, uint32_t& task);		// pops a local task, otherwise steals one
+	void execute(uint32_t task, uint32_t thread);
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	const std::function<void(uint32_t, uint32_t)>* job{ nullptr };
+
+	std::mutex state_lock;
+	std::condition_variable wake, finished;
+	std::atomic<uint32_t> remaining{ 0 };
+	uint64_t generation{ 0 };	// incremented for each job so that sleeping workers know to look for tasks
+	bool stop{ false }, pin{ false };
+
+
+};
\ No newline at end of file
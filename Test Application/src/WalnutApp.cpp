@@ -1,6 +1,7 @@
 #include <chrono>
 #include <vector>
 #include <thread>
+#include <mutex>
 
 #include "Walnut/Application.h"
 #include "Walnut/EntryPoint.h"
@@ -22,7 +23,7 @@ public:
 
 
 	virtual void OnUpdate(float ts) override {
-		if (this->camera.OnUpdate(ts)) {
+		if (this->camera.OnUpdate(ts) && !(this->renderer.properties.render_flags & Renderer::RenderMode_Reproject)) {	// otherwise the renderer carries the accumulation over to the new view
 			//this->renderer.resetRender();
 			this->renderer.resetAccumulation();
 		}
@@ -40,11 +41,18 @@ public:
 			if (ImGui::Button(this->pause ? "Unpause Render" : "Pause Render")) { this->pause = !this->pause; }
 			ImGui::SameLine();
 			if (ImGui::Button("Restart Render")) { needs_reset = true; }
+			if (ImGui::Button("Save Checkpoint")) { this->checkpoint_request = Checkpoint_Save; }
+			ImGui::SameLine();
+			if (ImGui::Button("Resume Checkpoint")) { this->checkpoint_request = Checkpoint_Load; }
+			ImGui::DragInt("Checkpoint Every (frames)", &this->checkpoint_every, 1.f, 0, 100000, this->checkpoint_every ? "%d" : "never", ImGuiSliderFlags_Logarithmic | ImGuiSliderFlags_AlwaysClamp);
+			static const char* const CHECKPOINT_STATUS[] = { "", "Saving to", "Resumed from", "No matching" };
+			if (this->checkpoint_status) { ImGui::Text("%s %s", CHECKPOINT_STATUS[this->checkpoint_status], CHECKPOINT_FILE); }
 			ImGui::Separator();
 			needs_reset |= this->renderer.invokeGuiOptions();
 		} ImGui::End();
 	// Call Scene and property editor windows
 		ImGui::Begin("Scene"); {
+			std::scoped_lock l(this->scene_lock);	// edits are only queued, the render thread applies them between frames
 			needs_reset |= this->scene.invokeGuiOptions();
 		} ImGui::End();
 		ImGui::Begin("Materials"); {
@@ -64,7 +72,14 @@ public:
 					if (needs_reset || (frame && (this->frame_width != this->frame->GetWidth() || this->frame_height != this->frame->GetHeight()))) {	// if the scene changed or the window size changed
 						this->renderer.resetRender();
 					}
-					this->frame = this->renderer.getOutput();
+					this->renderer.readOutput([this](const uint32_t* rgba, uint32_t w, uint32_t h) {
+						if (!this->frame) {
+							this->frame = std::make_shared<Walnut::Image>(w, h, Walnut::ImageFormat::RGBA);
+						} else if (this->frame->GetWidth() != w || this->frame->GetHeight() != h) {
+							this->frame->Resize(w, h);
+						}
+						this->frame->SetData(rgba);
+					});
 				}
 				if (frame) {
 					ImGui::Image(frame->GetDescriptorSet(), { (float)frame->GetWidth(), (float)frame->GetHeight() }, ImVec2(0, 1), ImVec2(1, 0));
@@ -88,7 +103,7 @@ protected:
 		while (this->frame_width == 0 || this->frame_height == 0) {
 			std::this_thread::sleep_for(std::chrono::milliseconds(100));	// wait until window has been initialized
 		}
-		this->camera.OnResize(this->frame_width, this->frame_height, this->renderer.properties.aa_random_rays);
+		this->camera.OnResize(this->frame_width, this->frame_height);
 		this->renderer.resize(this->frame_width, this->frame_height);
 		while (!this->exit) {
 			if (this->pause) {
@@ -96,7 +111,30 @@ protected:
 			} else {
 				this->camera.OnResize(this->frame_width, this->frame_height);
 				this->renderer.resize(this->frame_width, this->frame_height);
+				{
+					std::scoped_lock l(this->scene_lock);
+					if (this->scene.applyEdits()) {
+						this->renderer.resetRender();	// in case the gui's reset came before the edit was applied
+					}
+				}
+				const uint32_t request = this->checkpoint_request.exchange(Checkpoint_None);
+				if (request == Checkpoint_Load) {
+					const bool ok = this->renderer.loadCheckpoint(CHECKPOINT_FILE, this->scene, this->camera);
+					this->checkpoint_status = ok ? Checkpoint_Load : Checkpoint_Failed;
+					this->checkpoint_last = this->renderer.getAccumulatedFrames();
+				}
 				this->renderer.render(this->scene, this->camera);
+				// saves are written in the background, and skipped while the last one is still going
+				const uint32_t frames = this->renderer.getAccumulatedFrames(), every = (uint32_t)this->checkpoint_every;
+				if (frames < this->checkpoint_last) {	// restarted
+					this->checkpoint_last = 0;
+				}
+				if (request == Checkpoint_Save || (every && frames >= this->checkpoint_last + every)) {
+					if (this->renderer.saveCheckpoint(CHECKPOINT_FILE, this->scene, this->camera)) {
+						this->checkpoint_status = Checkpoint_Save;
+						this->checkpoint_last = frames;
+					}
+				}
 			}
 		}
 		this->exit = false;
@@ -113,8 +151,20 @@ private:
 	uint32_t frame_width = 0, frame_height = 0;
 
 	std::thread render_thread;
+	std::mutex scene_lock;		// held while the gui edits the scene, and while the render thread applies the edits
 	std::atomic_bool pause{ false }, exit{ false };
 
+	enum {
+		Checkpoint_None = 0,
+		Checkpoint_Save,
+		Checkpoint_Load,
+		Checkpoint_Failed	// status only
+	};
+	static constexpr const char* CHECKPOINT_FILE = "render.ckpt";
+	std::atomic<uint32_t> checkpoint_request{ Checkpoint_None }, checkpoint_status{ Checkpoint_None };
+	uint32_t checkpoint_last = 0;	// accumulated frames at the last save, owned by the render thread
+	int checkpoint_every = 0;
+
 	float ltime = 0.f;
 
 
@@ -7,4 +7,6 @@ workspace "Test Applicaiton"
 outputdir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
 include "Walnut/WalnutExternal.lua"
 
-include "Test Application"
\ No newline at end of file
+include "Test Application"
+include "Headless"
+include "Benchmark"
\ No newline at end of file